@@ -0,0 +1,56 @@
+// Resizes the thread pools of a running planner, by hand and by the autoscaler, while the sample ships are sold.
+// Built by "make check" with AddressSanitizer, a retired thread that is never joined or joined twice shows up there.
+#define main SolutionMain
+#include "solution.cpp"
+#undef main
+
+static int g_Failures = 0;
+
+/** Sells rounds of the sample ships, resizing the pools between the rounds, and validates all of them. */
+static void Run(const char * name, bool autoScale) {
+    CCargoPlanner test;
+    vector<AShipTest> ships;
+    vector<ACustomerTest> customers{make_shared<CCustomerTest>(), make_shared<CCustomerTest>()};
+    for (auto x : customers)
+        test.Customer(x);
+    if (autoScale)
+        test.AutoScale(1, 4, chrono::milliseconds(5), 2);
+    test.Start(3, 2);
+
+    const int rounds = 2;
+    for (int round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < g_TestExtra.size(); ++i) {
+            ships.push_back(g_TestExtra[i].PrepareTest("D" + to_string(round) + "-" + to_string(i), customers));
+            test.Ship(ships.back());
+        }
+        // one sales thread and one worker are always kept, the rest may go
+        test.AddSales(1);
+        if (test.RemoveSales(round + 1) != round + 1) {
+            printf("%s: round %d, RemoveSales did not remove %d threads\n", name, round, round + 1);
+            ++g_Failures;
+        }
+        test.AddWorkers(2);
+        test.RemoveWorkers(1);
+        test.AddSales(round + 1);
+    }
+    if (test.RemoveSales(1000) >= 1000 || test.RemoveWorkers(1000) >= 1000) {
+        printf("%s: the last threads were removed\n", name);
+        ++g_Failures;
+    }
+
+    test.Stop();
+
+    for (auto x : ships)
+        if (!x->Validate()) {
+            printf("%s: %s failed\n", name, x->Destination().c_str());
+            ++g_Failures;
+        }
+}
+
+int main(void) {
+    Run("manual", false);
+    Run("autoscale", true);
+
+    printf("%s: %d failures\n", g_Failures ? "FAILED" : "ok", g_Failures);
+    return g_Failures != 0;
+}
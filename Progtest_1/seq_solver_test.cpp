@@ -0,0 +1,83 @@
+// Compares CCargoPlanner::SeqSolver with a brute force over all subsets of small random works. Built by "make check"
+// with AddressSanitizer, so the padded rows and the recorded choices of SeqSolverDP are checked for overruns as well.
+#include <random>
+#define main SolutionMain
+#include "solution.cpp"
+#undef main
+
+static int g_Failures = 0;
+
+/** The best fee of any subset that fits the ship, by trying all of them. */
+static long long BruteForce(const vector<CCargo> &cargo, int maxWeight, int maxVolume) {
+    long long best = 0;
+    for (uint32_t mask = 0; mask < (1u << cargo.size()); ++mask) {
+        long long fee = 0, weight = 0, volume = 0;
+        for (size_t i = 0; i < cargo.size(); ++i)
+            if (mask >> i & 1) {
+                fee += cargo[i].m_Fee;
+                weight += cargo[i].m_Weight;
+                volume += cargo[i].m_Volume;
+            }
+        if (weight <= maxWeight && volume <= maxVolume)
+            best = max(best, fee);
+    }
+    return best;
+}
+
+/** Runs SeqSolver on top of a load that already holds one item and checks the fee, the returned value and that the
+ *  new load is a subset of the cargo that fits the ship. */
+static void Check(const char * name, const vector<CCargo> &cargo, int maxWeight, int maxVolume, long long expected) {
+    const CCargo first(-1, -1, -1);
+    vector<CCargo> load{first};
+    int res = CCargoPlanner::SeqSolver(cargo, maxWeight, maxVolume, load);
+    vector<bool> used(cargo.size(), false);
+    long long fee = 0, weight = 0, volume = 0;
+    bool subset = load[0].m_Fee == first.m_Fee;
+    for (size_t l = 1; l < load.size(); ++l) {
+        size_t i = 0;
+        while (i < cargo.size() && (used[i] || cargo[i].m_Fee != load[l].m_Fee || cargo[i].m_Weight != load[l].m_Weight
+                                    || cargo[i].m_Volume != load[l].m_Volume))
+            ++i;
+        if (i == cargo.size()) {
+            subset = false;
+            break;
+        }
+        used[i] = true;
+        fee += load[l].m_Fee;
+        weight += load[l].m_Weight;
+        volume += load[l].m_Volume;
+    }
+    if (!subset || fee != expected || weight > maxWeight || volume > maxVolume || res != int(min<long long>(fee, INT_MAX))) {
+        printf("%s: %zu items, ship %d/%d: expected %lld, got %lld (returned %d, %s)\n", name, cargo.size(), maxWeight,
+               maxVolume, expected, fee, res, subset ? "subset" : "not a subset");
+        ++g_Failures;
+    }
+}
+
+int main(void) {
+    mt19937 rng(12345);
+    auto uniform = [&rng](int lo, int hi) { return uniform_int_distribution<int>(lo, hi)(rng); };
+    // the fee ranges pick 16, 32 and 64 bit cells, the volumes span several 64 cell blocks of a row
+    const int fees[] = {100, 100000, 1000000000};
+    for (int maxFee : fees)
+        for (int rep = 0; rep < 300; ++rep) {
+            vector<CCargo> cargo;
+            const int items = uniform(1, 12), maxWeight = uniform(0, 80), maxVolume = uniform(0, 200);
+            for (int i = 0; i < items; ++i)
+                cargo.emplace_back(uniform(0, maxFee), uniform(0, maxWeight / 2 + 5), uniform(0, maxVolume / 2 + 70));
+            Check("random", cargo, maxWeight, maxVolume, BruteForce(cargo, maxWeight, maxVolume));
+        }
+
+    // items without weight or volume update a row from itself
+    vector<CCargo> light{CCargo(5, 0, 3), CCargo(7, 2, 0), CCargo(11, 0, 0), CCargo(13, 3, 4)};
+    Check("zero sizes", light, 2, 3, BruteForce(light, 2, 3));
+    Check("empty ship", light, 0, 0, 11);
+
+    // nothing fits or pays, the result is known without a table that would not fit the memory
+    Check("no cargo", {}, INT_MAX, INT_MAX, 0);
+    Check("too heavy", {CCargo(10, 2000000, 1), CCargo(20, 1, 2000000)}, 1000000, 1000000, 0);
+    Check("no fee", {CCargo(0, 1, 1), CCargo(-5, 1, 1)}, INT_MAX, INT_MAX, 0);
+
+    printf("%s: %d failures\n", g_Failures ? "FAILED" : "ok", g_Failures);
+    return g_Failures != 0;
+}
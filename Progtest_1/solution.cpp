@@ -32,8 +32,21 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <coroutine>
+#include <future>
+#include <span>
+#include <fstream>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif /* __linux__ */
+#include <sys/wait.h>
 #include "progtest_solver.h"
 #include "sample_tester.h"
 
@@ -51,11 +64,25 @@ void salesThread(int tid, CCargoPlanner * cargoPlanner);
 /** Work thread function. */
 void workThread(int tid, CCargoPlanner * cargoPlanner);
 
+/** Autoscaler thread function. */
+void scaleThread(CCargoPlanner * cargoPlanner);
+
+/** Completion of a ship submitted by ShipBatch, fired right after the ship is loaded. */
+struct completion_t {
+    promise<void>                   m_promise;
+    function<void(const AShip &)>   m_callback;
+    explicit completion_t(function<void(const AShip &)> callback):m_callback(std::move(callback)){}
+    ~completion_t() = default;
+};
+
 /** Sale struct for sales thread. */
 struct sale_t {
     shared_ptr<CShip>   m_ship;
     bool                m_end;
-    sale_t(shared_ptr<CShip> ship, bool end):m_ship(std::move(ship)), m_end(end){}
+    coroutine_handle<>  m_resume;   // set if the sale is a suspended SellShip coroutine whose quotes are answered
+    shared_ptr<completion_t> m_done;
+    sale_t(shared_ptr<CShip> ship, bool end, coroutine_handle<> resume = nullptr, shared_ptr<completion_t> done = nullptr)
+        :m_ship(std::move(ship)), m_end(end), m_resume(resume), m_done(std::move(done)){}
     ~sale_t() = default;
 };
 
@@ -65,34 +92,302 @@ struct work_t {
     shared_ptr<vector<CCargo>>  m_cargo;
     shared_ptr<CShip>           m_ship;
     bool                        m_end;
-    work_t(int tid, shared_ptr<vector<CCargo>> cargo, shared_ptr<CShip> ship, bool end):m_tid(tid),m_cargo(std::move(cargo)), m_ship(std::move(ship)), m_end(end){}
+    shared_ptr<completion_t>    m_done;
+    work_t(int tid, shared_ptr<vector<CCargo>> cargo, shared_ptr<CShip> ship, bool end, shared_ptr<completion_t> done = nullptr)
+        :m_tid(tid),m_cargo(std::move(cargo)), m_ship(std::move(ship)), m_end(end), m_done(std::move(done)){}
     ~work_t() = default;
+    void Load(const vector<CCargo> & load) const;
+};
+
+/** Quote settings of one customer. */
+struct quote_policy_t {
+    chrono::milliseconds        m_timeout;      // zero = wait for the quote forever
+    chrono::milliseconds        m_hedge;        // zero = no hedging, otherwise re-issue the quote after this delay
+    bool                        m_useCached;    // on timeout fall back to the last quote for the destination
+    quote_policy_t(chrono::milliseconds timeout = chrono::milliseconds(0), chrono::milliseconds hedge = chrono::milliseconds(0), bool useCached = false)
+        :m_timeout(timeout), m_hedge(hedge), m_useCached(useCached){}
+    ~quote_policy_t() = default;
+};
+
+/** Quote counters of one customer. */
+struct quote_stats_t {
+    uint64_t                    m_calls = 0;        // quotes requested by the sales threads
+    uint64_t                    m_completed = 0;    // quotes answered, late ones included, a hedged quote counts its first answer only
+    uint64_t                    m_timeouts = 0;
+    uint64_t                    m_hedges = 0;
+    uint64_t                    m_cached = 0;       // timeouts answered from the cache
+    chrono::nanoseconds         m_totalLatency = chrono::nanoseconds(0);
+    chrono::nanoseconds         m_maxLatency = chrono::nanoseconds(0);
+};
+
+/** Customer registered in the planner. */
+struct customer_t {
+    ACustomer                   m_customer;
+    quote_policy_t              m_policy;
+    mutex                       m_mtx;
+    quote_stats_t               m_stats;
+    map<string, vector<CCargo>> m_cache;        // last quote per destination, only kept with m_useCached
+    customer_t(ACustomer customer, const quote_policy_t & policy):m_customer(std::move(customer)), m_policy(policy){}
+    ~customer_t() = default;
+    void Record(chrono::nanoseconds latency, const string & destination, const vector<CCargo> & cargo);
+};
+
+/** One quote in flight, shared by the sales thread and the pool threads calling Quote. */
+struct quote_t {
+    static const int            ORIGINAL = 0, HEDGE = 1;
+    mutex                       m_mtx;
+    condition_variable          cv_done;
+    bool                        m_done = false;     // answered or given up by the sales thread
+    int                         m_answer = -1;      // slot answered first
+    vector<CCargo>              v_cargo[2];         // per slot, the original call and its hedge never share one
+    chrono::steady_clock::time_point m_issued = chrono::steady_clock::now();
+};
+
+/**
+ * Elastic pool of threads for blocking Quote calls, a stuck customer only ever holds its own thread. The threads are
+ * detached and share the pool state with the pool, so Stop does not wait for a Quote that never returns, its thread
+ * finishes the job whenever it does and exits. The jobs must not need the planner once it may be gone.
+ */
+class CQuotePool {
+private:
+    struct state_t {
+        mutex                   m_mtx;
+        condition_variable      cv_job;
+        deque<function<void()>> q_jobs;
+        int                     m_idle = 0;
+        int                     m_threads = 0;
+        int                     m_max = 64;         // 0 for no limit
+        bool                    m_stop = false;
+    };
+    shared_ptr<state_t>         m_state = make_shared<state_t>();
+    static void Loop(shared_ptr<state_t> state);
+public:
+    CQuotePool() = default;
+    ~CQuotePool() { Stop(); }
+    void Limit(int threads);
+    void Submit(function<void()> job);
+    void Stop();
+};
+
+/**
+ * Customer able to quote without blocking the caller. QuoteAsync fills in the cargo and then calls done exactly
+ * once, from any thread. The planner keeps the cargo vector alive until done is called.
+ */
+class CAsyncCustomer : public CCustomer {
+public:
+    virtual void QuoteAsync(const string & destination, vector<CCargo> & cargo, function<void()> done) = 0;
+    void Quote(const string & destination, vector<CCargo> & cargo) override;
+};
+typedef shared_ptr<CAsyncCustomer> AAsyncCustomer;
+
+/** Fire-and-forget coroutine running one sale, it frees itself when it returns. */
+struct sale_task {
+    struct promise_type {
+        sale_task get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+/** Single thread running delayed callbacks, used for the quote timeouts of the coroutine sales. */
+class CTimer {
+private:
+    mutex                                                   m_mtx;
+    condition_variable                                      cv_change;
+    multimap<chrono::steady_clock::time_point, function<void()>> m_events;
+    bool                                                    m_stop = false;
+    thread                                                  m_thread;
+    void Loop();
+public:
+    CTimer() = default;
+    ~CTimer();
+    void Add(chrono::steady_clock::time_point when, function<void()> callback);
+};
+
+/** Answers of all customers for one coroutine sale. */
+struct gather_t {
+    mutex                       m_mtx;
+    string                      m_destination;
+    vector<vector<CCargo>>      v_cargo;    // per customer
+    vector<bool>                v_done;     // answered or timed out
+    vector<bool>                v_answered; // a Quote call returned, a hedged quote only records its first one
+    vector<chrono::steady_clock::time_point> v_issued;
+    size_t                      m_left;     // unanswered customers plus one for the coroutine still suspending
+    coroutine_handle<>          m_waiter;
+    shared_ptr<CShip>           m_ship;
+    gather_t(string destination, size_t customers, shared_ptr<CShip> ship)
+        :m_destination(std::move(destination)), v_cargo(customers), v_done(customers, false), v_answered(customers, false), v_issued(customers), m_left(customers + 1), m_ship(std::move(ship)){}
+    ~gather_t() = default;
+    bool Settle(size_t customer, customer_t & c, const vector<CCargo> * cargo);
+};
+
+/**
+ * Byte ring in shared memory, the producer and the consumer may live in different processes. The records are
+ * 8 byte aligned and start with their length, a record never wraps, the space up to the end is padded instead.
+ * The mutex is robust, a process dying inside the critical section does not lock the ring for good. The waits use
+ * semaphores posted once per waiter, a process shared condition variable is left broken by a waiter killed inside it.
+ */
+struct ring_t {
+    pthread_mutex_t             m_mtx;
+    sem_t                       m_notEmpty;
+    sem_t                       m_notFull;
+    uint32_t                    m_emptyWaiters;
+    uint32_t                    m_fullWaiters;
+    uint64_t                    m_head;     // bytes written, both positions start over from 0 when the ring drains
+    uint64_t                    m_tail;     // bytes read
+    uint64_t                    m_size;
+    uint8_t * Data() { return (uint8_t *) (this + 1); }
+    void Init(uint64_t size);
+    void Lock();
+    void Unlock() { pthread_mutex_unlock(&m_mtx); }
+    bool Wait(sem_t & sem, uint32_t & waiters, const timespec * deadline);
+    static void Wake(sem_t & sem, uint32_t & waiters);
+    bool Put(const void * header, size_t headerLen, const void * body, size_t bodyLen, bool wait);
+    bool Get(vector<uint8_t> & record, int timeoutMs);
+    void Reset();
+};
+
+/** Record header in the rings of a shard. */
+struct record_t {
+    uint32_t                    m_len;      // whole record, header included, before alignment, set by ring_t::Put
+    uint32_t                    m_kind;
+    uint64_t                    m_id;
+    int32_t                     m_maxWeight;
+    int32_t                     m_maxVolume;
+    uint32_t                    m_count;    // CCargo items following the header
+    uint32_t                    m_pad;
+    static const uint32_t       PAD = 0, WORK = 1, RESULT = 2, END = 3, STOP = 4;   // STOP only wakes the collector
+};
+
+/** Message of the zygote on its reply pipe, the pid of a started solver or of a solver that has exited. */
+struct zygote_msg_t {
+    pid_t                       m_pid;
+    int32_t                     m_exited;
+};
+
+/** Solver process with its pair of rings, the front process keeps the work in flight to resubmit it after a crash. */
+struct shard_t {
+    pid_t                       m_pid = -1;
+    void *                      m_mem = nullptr;
+    size_t                      m_memSize = 0;
+    ring_t *                    m_req = nullptr;
+    ring_t *                    m_res = nullptr;
+    mutex                       m_mtx;
+    map<uint64_t, shared_ptr<work_t>> m_inflight;
+    bool                        m_ending = false;   // the collector sends END to the solver once it sees it
+    bool                        m_exited = false;   // the zygote reported the exit of m_pid
+    int                         m_restarts = 0;
+    thread                      m_collector;
+};
+
+/** Autoscaler settings for the worker pool. */
+struct autoscale_t {
+    int                         m_minWorkers;
+    int                         m_maxWorkers;
+    chrono::milliseconds        m_interval;
+    int                         m_ticks;    // consecutive samples needed before the pool is resized
+    autoscale_t(int minWorkers, int maxWorkers, chrono::milliseconds interval, int ticks):m_minWorkers(minWorkers), m_maxWorkers(maxWorkers), m_interval(interval), m_ticks(ticks){}
+    ~autoscale_t() = default;
+};
+
+/** Placement policy for the planner threads. */
+struct placement_t {
+    vector<int>                 v_workerCpus;   // cores for work threads, assigned round robin by tid, empty = not pinned
+    vector<int>                 v_salesCpus;    // cores for sales threads, keep them apart from v_workerCpus
+    bool                        m_localCargo;   // copy the cargo into the worker's own memory before solving
+    placement_t():m_localCargo(true){}
+    ~placement_t() = default;
+    static vector<int> NodeCpus(int node);
 };
 
 class CCargoPlanner {
 public: // ew public member variables
-    int                             m_numOfSalesThreads;
-    int                             m_numOfWorkThreads;
+    int                             m_numOfSalesThreads;    // sales threads ever started, next sales tid
+    int                             m_numOfWorkThreads;     // work threads ever started, next work tid
     mutex                           m_runningMtx;
-    int                             m_runningSales;
-    int                             m_runningWorkers;
-    vector<shared_ptr<CCustomer>>   v_customers;
+    int                             m_runningSales;         // sales threads not asked to retire
+    int                             m_runningWorkers;       // work threads not asked to retire
+    int                             m_liveSales;            // sales threads that have not exited yet
+    bool                            m_stopping;
+    vector<int>                     v_retiredSales;         // exited sales threads waiting for join
+    vector<int>                     v_retiredWorkers;       // exited work threads waiting for join
+    vector<shared_ptr<customer_t>>  v_customers;
+    CQuotePool                      m_quotePool;
     deque<shared_ptr<sale_t>>       q_sales;
     deque<shared_ptr<work_t>>       q_work;
-    vector<thread>                  m_salesThreadsV;
-    vector<thread>                  m_workThreadsV;
+    map<int, thread>                m_salesThreadsM;
+    map<int, thread>                m_workThreadsM;
     mutex                           m_saleMtx;
     mutex                           m_workMtx;
+    int                             m_idleWorkers;          // workers blocked in RemoveWork, guarded by m_workMtx
     condition_variable              cv_emptyShipQ;
     condition_variable              cv_emptyWorkQ;
+    unique_ptr<autoscale_t>         m_scale;
+    thread                          m_scaleThread;
+    mutex                           m_scaleMtx;
+    bool                            m_scaleStop;
+    condition_variable              cv_scaleStop;
+    placement_t                     m_placement;
+    bool                            m_asyncSales;
+    int                             m_inflightSales;        // ships accepted but not yet handed to the workers, async sales only
+    mutex                           m_inflightMtx;
+    condition_variable              cv_inflight;
+    unique_ptr<CTimer>              m_timer;
+    vector<unique_ptr<shard_t>>     v_shards;
+    atomic<uint64_t>                m_nextWorkId;
+    pid_t                           m_zygotePid;            // single threaded process forking the solver processes
+    int                             m_zygoteCmd;            // ring pair to start a solver for, written by the front
+    int                             m_zygoteReply;          // started and exited solvers, read by the front in order
+    mutex                           m_zygoteMtx;
 public:
     CCargoPlanner();
     ~CCargoPlanner();
     void Customer(const ACustomer& customer);
+    void Customer(const ACustomer& customer, const quote_policy_t & policy);
     void Start(int sales, int workers);
+    void Start(int sales, int workers, const placement_t & placement);
     void Ship(AShip ship);
+    vector<future<void>> ShipBatch(span<const AShip> ships, function<void(const AShip &)> callback = nullptr);
     void Stop();
     static int SeqSolver(const vector<CCargo> &cargo, int maxWeight, int maxVolume, vector<CCargo> &load);
+    template <typename T>
+    static int SeqSolverDP(const vector<CCargo> &cargo, int maxWeight, int maxVolume, vector<CCargo> &load);
+public:
+    void AddSales(int count);
+    int RemoveSales(int count);
+    void AddWorkers(int count);
+    int RemoveWorkers(int count);
+    void AutoScale(int minWorkers, int maxWorkers, chrono::milliseconds interval = chrono::milliseconds(50), int ticks = 3);
+    void ReapThreads();
+    static bool PinThread(const vector<int> & cpus, int tid);
+    void QuoteThreads(int threads);
+    void QuoteAll(const string & destination, vector<CCargo> & cargo);
+    void IssueQuote(const shared_ptr<customer_t> & customer, const shared_ptr<quote_t> & quote, const string & destination, int slot);
+    quote_stats_t QuoteStats(size_t customer);
+    void PrintQuoteStats(ostream & os);
+public:
+    void AsyncSales(bool enable = true);
+    static sale_task SellShip(CCargoPlanner * cargoPlanner, shared_ptr<sale_t> sale);
+    bool IssueAll(shared_ptr<gather_t> gather, coroutine_handle<> waiter);
+    void Answer(const shared_ptr<gather_t> & gather, size_t customer, const vector<CCargo> * cargo);
+    void Resume(const shared_ptr<gather_t> & gather);
+    void SaleDone();
+public:
+    void StartSharded(int sales, int processes, size_t ringBytes = 1 << 22);
+    bool StartZygote();
+    static void ZygoteMain(int cmd, int reply);
+    bool SpawnShard(shard_t & shard);
+    void ReadExits();
+    void MarkExited(pid_t pid);
+    bool ShardExited(shard_t & shard);
+    bool ShardWork(const shared_ptr<work_t> & work);
+    bool PutWork(shard_t & shard, uint64_t id, const work_t & work, bool wait);
+    void CollectShard(shard_t & shard);
+    void RestartShard(shard_t & shard);
+    void StopShards();
+    static void ShardMain(ring_t * req, ring_t * res);
 public:
     virtual void InsertSale(const shared_ptr<sale_t> & sale);
     virtual shared_ptr<sale_t> RemoveSale(int tid);
@@ -102,50 +397,1145 @@ public:
 };
 
 //// CCargo class methods definition ////-------------------------------------------------------------------------------
-CCargoPlanner::CCargoPlanner():m_numOfSalesThreads(0), m_numOfWorkThreads(0), m_runningSales(0), m_runningWorkers(0){}
+CCargoPlanner::CCargoPlanner():m_numOfSalesThreads(0), m_numOfWorkThreads(0), m_runningSales(0), m_runningWorkers(0),
+                               m_liveSales(0), m_stopping(false), m_idleWorkers(0), m_scaleStop(false),
+                               m_asyncSales(false), m_inflightSales(0), m_nextWorkId(0),
+                               m_zygotePid(-1), m_zygoteCmd(-1), m_zygoteReply(-1){}
 
-CCargoPlanner::~CCargoPlanner() = default;
+CCargoPlanner::~CCargoPlanner() {
+    // the timer callbacks use the planner and end first, a quote job still blocked in Quote is left to its thread
+    m_timer.reset();
+    m_quotePool.Stop();
+}
 
 void CCargoPlanner::Customer(const ACustomer& customer) {
-    v_customers.push_back(customer);
+    Customer(customer, quote_policy_t());
+}
+
+/**
+ * Registers a customer with its quote policy. With a timeout or a hedge, and for synchronous customers of coroutine
+ * sales, Quote runs on a thread of the quote pool. A call that has not returned by the time the planner is destroyed
+ * keeps its thread, and the thread keeps the customer alive, until Quote returns.
+ */
+void CCargoPlanner::Customer(const ACustomer& customer, const quote_policy_t & policy) {
+    v_customers.push_back(make_shared<customer_t>(customer, policy));
 }
 void CCargoPlanner::Start(int sales, int workers) {
-    m_numOfSalesThreads = sales;
-    m_numOfWorkThreads = workers;
-    m_runningSales = sales;
-    m_runningWorkers = workers;
-    for (int i = 0; i < m_numOfSalesThreads; ++i) {
-        m_salesThreadsV.emplace_back(salesThread, i, this );
-    }
-    for (int i = 0; i < m_numOfWorkThreads; ++i) {
-        m_workThreadsV.emplace_back(workThread, i, this );
-    }
+    AddSales(sales);
+    AddWorkers(workers);
+    if (m_scale)
+        m_scaleThread = thread(scaleThread, this);
+}
+
+void CCargoPlanner::Start(int sales, int workers, const placement_t & placement) {
+    m_placement = placement;
+    Start(sales, workers);
 }
 
 void CCargoPlanner::Ship(AShip ship) {
+    if (m_asyncSales) {
+        unique_lock<mutex> ul (m_inflightMtx);
+        m_inflightSales++;
+    }
     sale_t sale(std::move(ship), false);
     InsertSale(make_shared<sale_t>(sale));
 }
 
+/** Enqueues the ships under a single lock, each one gets a future (and the callback) fired right after its Load. */
+vector<future<void>> CCargoPlanner::ShipBatch(span<const AShip> ships, function<void(const AShip &)> callback) {
+    vector<future<void>> futures;
+    futures.reserve(ships.size());
+    vector<shared_ptr<sale_t>> sales;
+    sales.reserve(ships.size());
+    for (const AShip & ship : ships) {
+        auto done = make_shared<completion_t>(callback);
+        futures.push_back(done->m_promise.get_future());
+        sales.push_back(make_shared<sale_t>(ship, false, nullptr, std::move(done)));
+    }
+    if (m_asyncSales) {
+        unique_lock<mutex> ul (m_inflightMtx);
+        m_inflightSales += ships.size();
+    }
+    unique_lock<mutex> ul (m_saleMtx);
+    q_sales.insert(q_sales.end(), sales.begin(), sales.end());
+    #ifdef DEBUG_PRINT
+    printf("Ship producer m:  %zu items were inserted\n", sales.size());
+    #endif /* DEBUG_PRINT */
+    ul.unlock();
+    cv_emptyShipQ.notify_all();
+    return futures;
+}
+
 void CCargoPlanner::Stop() {
     // notify all sales that the ships input has ended
     #ifdef DEBUG_PRINT
     printf("**************************** STOP REACHED ****************************\n");
     #endif /* DEBUG_PRINT */
+    // the autoscaler must not resize the pools while they are being drained
+    if (m_scaleThread.joinable()) {
+        unique_lock<mutex> ul (m_scaleMtx);
+        m_scaleStop = true;
+        ul.unlock();
+        cv_scaleStop.notify_all();
+        m_scaleThread.join();
+    }
+    // the suspended sales are resumed by the sales threads, these must not leave before the last sale is done
+    if (m_asyncSales) {
+        unique_lock<mutex> ul (m_inflightMtx);
+        cv_inflight.wait(ul, [ this ] () { return m_inflightSales == 0; } );
+    }
     // insert end messages for running sales
-    for (int i = 0; i < m_runningSales; i++) {
+    unique_lock<mutex> ul (m_runningMtx);
+    m_stopping = true;
+    int sales = m_runningSales;
+    m_runningSales = 0;
+    ul.unlock();
+    for (int i = 0; i < sales; i++) {
         sale_t sale_end(nullptr,true);
         InsertSale(make_shared<sale_t>(sale_end));
     }
     // wait until all threads complete their work
-    for (auto & t : m_salesThreadsV)
-        t.join();
-    for (auto & t : m_workThreadsV)
+    for (auto & t : m_salesThreadsM)
+        t.second.join();
+    for (auto & t : m_workThreadsM)
+        t.second.join();
+    m_salesThreadsM.clear();
+    m_workThreadsM.clear();
+    // the threads retired while stopping are joined above already
+    ul.lock();
+    v_retiredSales.clear();
+    v_retiredWorkers.clear();
+    ul.unlock();
+    StopShards();
+}
+
+void CCargoPlanner::AddSales(int count) {
+    ReapThreads();
+    unique_lock<mutex> ul (m_runningMtx);
+    for (int i = 0; i < count; ++i) {
+        int tid = m_numOfSalesThreads++;
+        m_runningSales++;
+        m_liveSales++;
+        m_salesThreadsM.emplace(tid, thread(salesThread, tid, this));
+    }
+}
+
+int CCargoPlanner::RemoveSales(int count) {
+    // keep at least one sales thread, the queued ships would never be quoted otherwise
+    unique_lock<mutex> ul (m_runningMtx);
+    count = max(0, min(count, m_runningSales - 1));
+    m_runningSales -= count;
+    ul.unlock();
+    for (int i = 0; i < count; i++) {
+        sale_t sale_end(nullptr,true);
+        InsertSale(make_shared<sale_t>(sale_end));
+    }
+    return count;
+}
+
+void CCargoPlanner::AddWorkers(int count) {
+    ReapThreads();
+    unique_lock<mutex> ul (m_runningMtx);
+    for (int i = 0; i < count; ++i) {
+        int tid = m_numOfWorkThreads++;
+        m_runningWorkers++;
+        m_workThreadsM.emplace(tid, thread(workThread, tid, this));
+    }
+}
+
+int CCargoPlanner::RemoveWorkers(int count) {
+    // keep at least one worker, the queued work would never be solved otherwise
+    unique_lock<mutex> ul (m_runningMtx);
+    count = max(0, min(count, m_runningWorkers - 1));
+    m_runningWorkers -= count;
+    ul.unlock();
+    for (int i = 0; i < count; i++) {
+        work_t work_end(-1, nullptr, nullptr, true);
+        InsertWork(make_shared<work_t>(work_end));
+    }
+    return count;
+}
+
+/** Lets a background thread resize the worker pool by the depth of q_work, call before Start. */
+void CCargoPlanner::AutoScale(int minWorkers, int maxWorkers, chrono::milliseconds interval, int ticks) {
+    m_scale = make_unique<autoscale_t>(max(1, minWorkers), max(1, max(minWorkers, maxWorkers)), interval, max(1, ticks));
+}
+
+void CCargoPlanner::ReapThreads() {
+    // join the threads that already exited after being retired
+    unique_lock<mutex> ul (m_runningMtx);
+    vector<int> sales, workers;
+    sales.swap(v_retiredSales);
+    workers.swap(v_retiredWorkers);
+    vector<thread> done;
+    // a tid may already be joined by Stop, it is skipped then
+    auto take = [ &done ] (map<int, thread> & threads, int tid) {
+        auto it = threads.find(tid);
+        if (it == threads.end())
+            return;
+        if (it->second.joinable())
+            done.push_back(std::move(it->second));
+        threads.erase(it);
+    };
+    for (int tid : sales)
+        take(m_salesThreadsM, tid);
+    for (int tid : workers)
+        take(m_workThreadsM, tid);
+    ul.unlock();
+    for (auto & t : done)
         t.join();
 }
 
+/**
+ * Collects the quotes of all customers, the customers with a timeout or a hedge are asked in parallel on the quote
+ * pool. A quote is hedged by the same rule as in IssueAll: when the hedge comes before the timeout, or there is none.
+ */
+void CCargoPlanner::QuoteAll(const string & destination, vector<CCargo> & cargo) {
+    vector<shared_ptr<quote_t>> pending (v_customers.size());
+    // issue the pooled quotes first, so that their timeouts and hedges run concurrently
+    for (size_t i = 0; i < v_customers.size(); ++i) {
+        shared_ptr<customer_t> c = v_customers[i];
+        if (c->m_policy.m_timeout.count() == 0 && c->m_policy.m_hedge.count() == 0)
+            continue;
+        pending[i] = make_shared<quote_t>();
+        IssueQuote(c, pending[i], destination, quote_t::ORIGINAL);
+    }
+    vector<CCargo> temporaryCargo;
+    for (size_t i = 0; i < v_customers.size(); ++i) {
+        customer_t & c = *v_customers[i];
+        unique_lock<mutex> statsLock (c.m_mtx);
+        c.m_stats.m_calls++;
+        statsLock.unlock();
+        if (!pending[i]) {
+            auto issued = chrono::steady_clock::now();
+            c.m_customer->Quote(destination, temporaryCargo);
+            c.Record(chrono::steady_clock::now() - issued, destination, temporaryCargo);
+            cargo.insert(cargo.end(), temporaryCargo.begin(), temporaryCargo.end());
+            temporaryCargo.clear();
+            continue;
+        }
+        quote_t & q = *pending[i];
+        const quote_policy_t & policy = c.m_policy;
+        auto answered = [ &q ] () { return q.m_done; };
+        unique_lock<mutex> ul (q.m_mtx);
+        if (policy.m_hedge.count() != 0 && (policy.m_timeout.count() == 0 || policy.m_hedge < policy.m_timeout)
+            && !q.cv_done.wait_until(ul, q.m_issued + policy.m_hedge, answered)) {
+            // the quote is slow, ask again through another pool thread, the first answer wins
+            ul.unlock();
+            IssueQuote(v_customers[i], pending[i], destination, quote_t::HEDGE);
+            statsLock.lock();
+            c.m_stats.m_hedges++;
+            statsLock.unlock();
+            ul.lock();
+        }
+        // without a timeout only the hedge was bounded, the quote is waited for as long as it takes
+        if (policy.m_timeout.count() == 0)
+            q.cv_done.wait(ul, answered);
+        if (q.cv_done.wait_until(ul, q.m_issued + policy.m_timeout, answered)) {
+            const vector<CCargo> & answer = q.v_cargo[q.m_answer];
+            cargo.insert(cargo.end(), answer.begin(), answer.end());
+            continue;
+        }
+        // timed out, the late answer is only recorded in the statistics and the cache
+        q.m_done = true;
+        ul.unlock();
+        statsLock.lock();
+        c.m_stats.m_timeouts++;
+        if (c.m_policy.m_useCached) {
+            auto it = c.m_cache.find(destination);
+            if (it != c.m_cache.end()) {
+                c.m_stats.m_cached++;
+                cargo.insert(cargo.end(), it->second.begin(), it->second.end());
+            }
+        }
+        statsLock.unlock();
+        #ifdef DEBUG_PRINT
+        printf("Quote timeout: customer %zu, %s\n", i, destination.c_str());
+        #endif /* DEBUG_PRINT */
+    }
+}
+
+/**
+ * Calls Quote on a pool thread into the slot of the quote. The first answer is kept and counted in the statistics with
+ * the latency since the quote was issued, the later answer of the other slot is dropped.
+ */
+void CCargoPlanner::IssueQuote(const shared_ptr<customer_t> & customer, const shared_ptr<quote_t> & quote, const string & destination, int slot) {
+    m_quotePool.Submit([ customer, quote, destination, slot ] () {
+        // a quote queued past its timeout, or behind an answered hedge, is not needed any more
+        unique_lock<mutex> ul (quote->m_mtx);
+        if (quote->m_done)
+            return;
+        ul.unlock();
+        vector<CCargo> tmp;
+        customer->m_customer->Quote(destination, tmp);
+        ul.lock();
+        if (quote->m_answer >= 0)
+            return;
+        quote->m_answer = slot;
+        quote->v_cargo[slot] = std::move(tmp);
+        quote->m_done = true;
+        ul.unlock();
+        quote->cv_done.notify_all();
+        // the slot is not written any more, a late answer still refreshes the cache
+        customer->Record(chrono::steady_clock::now() - quote->m_issued, destination, quote->v_cargo[slot]);
+    });
+}
+
+quote_stats_t CCargoPlanner::QuoteStats(size_t customer) {
+    unique_lock<mutex> ul (v_customers[customer]->m_mtx);
+    return v_customers[customer]->m_stats;
+}
+
+void CCargoPlanner::PrintQuoteStats(ostream & os) {
+    for (size_t i = 0; i < v_customers.size(); ++i) {
+        quote_stats_t st = QuoteStats(i);
+        os << "customer " << i << ": calls " << st.m_calls << ", completed " << st.m_completed
+           << ", timeouts " << st.m_timeouts << ", hedges " << st.m_hedges << ", cached " << st.m_cached
+           << ", avg latency " << (st.m_completed ? st.m_totalLatency.count() / st.m_completed / 1000 : 0) << " us"
+           << ", max latency " << st.m_maxLatency.count() / 1000 << " us" << endl;
+    }
+}
+
+void customer_t::Record(chrono::nanoseconds latency, const string & destination, const vector<CCargo> & cargo) {
+    unique_lock<mutex> ul (m_mtx);
+    m_stats.m_completed++;
+    m_stats.m_totalLatency += latency;
+    m_stats.m_maxLatency = max(m_stats.m_maxLatency, latency);
+    if (m_policy.m_useCached)
+        m_cache[destination] = cargo;
+}
+
+void CQuotePool::Limit(int threads) {
+    unique_lock<mutex> ul (m_state->m_mtx);
+    m_state->m_max = threads;
+}
+
+void CQuotePool::Submit(function<void()> job) {
+    state_t & st = *m_state;
+    unique_lock<mutex> ul (st.m_mtx);
+    if (st.m_stop)
+        return;
+    st.q_jobs.push_back(std::move(job));
+    // a job does not wait behind a stuck Quote unless all the allowed threads are taken, then it stays queued
+    if ((int) st.q_jobs.size() > st.m_idle && (st.m_max == 0 || st.m_threads < st.m_max)) {
+        thread(&CQuotePool::Loop, m_state).detach();
+        st.m_threads++;
+    } else
+        st.cv_job.notify_one();
+}
+
+void CQuotePool::Stop() {
+    // idle threads exit now, the busy ones once their Quote returns, the jobs nobody waits for any more are dropped
+    deque<function<void()>> dropped;
+    unique_lock<mutex> ul (m_state->m_mtx);
+    m_state->m_stop = true;
+    dropped.swap(m_state->q_jobs);
+    ul.unlock();
+    m_state->cv_job.notify_all();
+}
+
+void CQuotePool::Loop(shared_ptr<state_t> state) {
+    state_t & st = *state;
+    unique_lock<mutex> ul (st.m_mtx);
+    while (true) {
+        st.m_idle++;
+        bool ready = st.cv_job.wait_for(ul, chrono::seconds(1), [ &st ] () { return st.m_stop || !st.q_jobs.empty(); } );
+        st.m_idle--;
+        // idle for too long or the pool is stopping
+        if (st.q_jobs.empty() && (!ready || st.m_stop)) {
+            st.m_threads--;
+            break;
+        }
+        if (st.q_jobs.empty())
+            continue;
+        function<void()> job = std::move(st.q_jobs.front());
+        st.q_jobs.pop_front();
+        ul.unlock();
+        job();
+        // the captures of the job go before the lock is taken, they may be the last references to a customer
+        job = nullptr;
+        ul.lock();
+    }
+}
+
+/**
+ * Limits the threads calling Quote for the customers with a timeout or a hedge and for the synchronous customers of
+ * coroutine sales, 0 for no limit, 64 by default. Quotes past the limit wait in a queue, a queued quote is given up
+ * at its timeout like a slow one and it is not asked at all once the sale no longer needs it.
+ */
+void CCargoPlanner::QuoteThreads(int threads) {
+    m_quotePool.Limit(threads);
+}
+
+/** Sells the ships in coroutines, a sales thread only blocks while it has nothing to run, call before Start. */
+void CCargoPlanner::AsyncSales(bool enable) {
+    m_asyncSales = enable;
+}
+
+/** Awaiter that asks all customers at once and resumes the sale when the last one answers or times out. */
+struct quotes_awaiter {
+    CCargoPlanner *             m_planner;
+    shared_ptr<gather_t>        m_gather;
+    bool await_ready() const noexcept { return m_planner->v_customers.empty(); }
+    bool await_suspend(coroutine_handle<> waiter) { return m_planner->IssueAll(m_gather, waiter); }
+    void await_resume() const noexcept {}
+};
+
+sale_task CCargoPlanner::SellShip(CCargoPlanner * cargoPlanner, shared_ptr<sale_t> sale) {
+    auto gather = make_shared<gather_t>(sale->m_ship->Destination(), cargoPlanner->v_customers.size(), sale->m_ship);
+    // a named awaiter, gcc mishandles the lifetime of temporaries with shared_ptr members in co_await
+    quotes_awaiter quotes{cargoPlanner, gather};
+    co_await quotes;
+    auto allCargoToLoad = make_shared<vector<CCargo>>();
+    for (auto & cargo : gather->v_cargo)
+        allCargoToLoad->insert(allCargoToLoad->end(), cargo.begin(), cargo.end());
+    work_t work(-1, allCargoToLoad, sale->m_ship, false, sale->m_done);
+    cargoPlanner->InsertWork(make_shared<work_t>(work));
+    cargoPlanner->SaleDone();
+}
+
+/**
+ * Starts the quotes of a coroutine sale, returns false if all of them were answered before it could suspend.
+ * The gather is taken by value, the sale may be resumed and finished by another thread before this returns.
+ */
+bool CCargoPlanner::IssueAll(shared_ptr<gather_t> gather, coroutine_handle<> waiter) {
+    gather->m_waiter = waiter;
+    for (size_t i = 0; i < v_customers.size(); ++i) {
+        shared_ptr<customer_t> c = v_customers[i];
+        unique_lock<mutex> statsLock (c->m_mtx);
+        c->m_stats.m_calls++;
+        statsLock.unlock();
+        gather->v_issued[i] = chrono::steady_clock::now();
+        // the original call and its hedge answer into their own vectors, only the first one is recorded and used
+        auto answered = [ this, c, gather, i ] (const vector<CCargo> & cargo) {
+            unique_lock<mutex> ul (gather->m_mtx);
+            if (gather->v_answered[i])
+                return;
+            gather->v_answered[i] = true;
+            ul.unlock();
+            c->Record(chrono::steady_clock::now() - gather->v_issued[i], gather->m_destination, cargo);
+            // only the answer completing the sale touches the planner, Stop waits for every sale in flight
+            if (gather->Settle(i, *c, &cargo))
+                Resume(gather);
+        };
+        auto quote = [ this, c, gather, i, answered ] () {
+            if (auto async = dynamic_pointer_cast<CAsyncCustomer>(c->m_customer)) {
+                auto cargo = make_shared<vector<CCargo>>();
+                async->QuoteAsync(gather->m_destination, *cargo, [ cargo, answered ] () { answered(*cargo); } );
+                return;
+            }
+            // synchronous customers block a thread of the quote pool instead of a sales thread
+            m_quotePool.Submit([ c, gather, i, answered ] () {
+                unique_lock<mutex> ul (gather->m_mtx);
+                bool done = gather->v_done[i];
+                ul.unlock();
+                if (done)
+                    return;
+                vector<CCargo> cargo;
+                c->m_customer->Quote(gather->m_destination, cargo);
+                answered(cargo);
+            });
+        };
+        const quote_policy_t & policy = c->m_policy;
+        if (policy.m_timeout.count() != 0 || policy.m_hedge.count() != 0) {
+            unique_lock<mutex> ul (m_inflightMtx);
+            if (!m_timer)
+                m_timer = make_unique<CTimer>();
+            ul.unlock();
+            if (policy.m_timeout.count() != 0)
+                m_timer->Add(gather->v_issued[i] + policy.m_timeout, [ this, gather, i ] () { Answer(gather, i, nullptr); } );
+            if (policy.m_hedge.count() != 0 && (policy.m_timeout.count() == 0 || policy.m_hedge < policy.m_timeout))
+                m_timer->Add(gather->v_issued[i] + policy.m_hedge, [ gather, i, c, quote ] () {
+                    unique_lock<mutex> ul (gather->m_mtx);
+                    bool done = gather->v_done[i];
+                    ul.unlock();
+                    if (done)
+                        return;
+                    unique_lock<mutex> statsLock (c->m_mtx);
+                    c->m_stats.m_hedges++;
+                    statsLock.unlock();
+                    quote();
+                } );
+        }
+        quote();
+    }
+    // drop the reference held while issuing, if the answers are all in the coroutine simply continues
+    unique_lock<mutex> ul (gather->m_mtx);
+    return --gather->m_left != 0;
+}
+
+/** Stores the first answer of a customer, nullptr marks a timeout. The last answer resumes the sale. */
+void CCargoPlanner::Answer(const shared_ptr<gather_t> & gather, size_t customer, const vector<CCargo> * cargo) {
+    if (gather->Settle(customer, *v_customers[customer], cargo))
+        Resume(gather);
+}
+
+/** Stores the first answer of customer c, nullptr marks a timeout. @return true for the last answer of the sale */
+bool gather_t::Settle(size_t customer, customer_t & c, const vector<CCargo> * cargo) {
+    unique_lock<mutex> ul (m_mtx);
+    if (v_done[customer])
+        return false;
+    v_done[customer] = true;
+    if (cargo)
+        v_cargo[customer] = *cargo;
+    else {
+        unique_lock<mutex> statsLock (c.m_mtx);
+        c.m_stats.m_timeouts++;
+        if (c.m_policy.m_useCached) {
+            auto it = c.m_cache.find(m_destination);
+            if (it != c.m_cache.end()) {
+                c.m_stats.m_cached++;
+                v_cargo[customer] = it->second;
+            }
+        }
+    }
+    return --m_left == 0;
+}
+
+/** Puts the answered sale before the new ships, so that the ships in flight finish first. */
+void CCargoPlanner::Resume(const shared_ptr<gather_t> & gather) {
+    unique_lock<mutex> saleLock (m_saleMtx);
+    q_sales.push_front(make_shared<sale_t>(gather->m_ship, false, gather->m_waiter));
+    cv_emptyShipQ.notify_one();
+}
+
+void CCargoPlanner::SaleDone() {
+    unique_lock<mutex> ul (m_inflightMtx);
+    if (--m_inflightSales == 0)
+        cv_inflight.notify_all();
+}
+
+void work_t::Load(const vector<CCargo> & load) const {
+    m_ship->Load(load);
+    if (m_done) {
+        if (m_done->m_callback)
+            m_done->m_callback(m_ship);
+        m_done->m_promise.set_value();
+    }
+}
+
+void CAsyncCustomer::Quote(const string & destination, vector<CCargo> & cargo) {
+    mutex mtx;
+    condition_variable cv;
+    bool done = false;
+    QuoteAsync(destination, cargo, [ & ] () {
+        unique_lock<mutex> ul (mtx);
+        done = true;
+        cv.notify_all();
+    });
+    unique_lock<mutex> ul (mtx);
+    cv.wait(ul, [ & ] () { return done; } );
+}
+
+CTimer::~CTimer() {
+    unique_lock<mutex> ul (m_mtx);
+    m_stop = true;
+    ul.unlock();
+    cv_change.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void CTimer::Add(chrono::steady_clock::time_point when, function<void()> callback) {
+    unique_lock<mutex> ul (m_mtx);
+    if (!m_thread.joinable())
+        m_thread = thread(&CTimer::Loop, this);
+    m_events.emplace(when, std::move(callback));
+    cv_change.notify_all();
+}
+
+void CTimer::Loop() {
+    unique_lock<mutex> ul (m_mtx);
+    while (!m_stop) {
+        if (m_events.empty()) {
+            cv_change.wait(ul);
+            continue;
+        }
+        auto first = m_events.begin();
+        if (first->first > chrono::steady_clock::now()) {
+            cv_change.wait_until(ul, first->first);
+            continue;
+        }
+        function<void()> callback = std::move(first->second);
+        m_events.erase(first);
+        ul.unlock();
+        callback();
+        ul.lock();
+    }
+}
+
+/**
+ * Starts the planner with the solver in separate processes. A zygote process is forked before any thread of the
+ * planner exists and forks the solvers, the first ones as well as the replacements of crashed ones, so no solver is
+ * ever forked from a multithreaded process. Each solver owns the destinations hashed to it and talks to the front
+ * process through two rings in a shared anonymous mapping. Ships of a crashed solver are resubmitted to its
+ * replacement.
+ */
+void CCargoPlanner::StartSharded(int sales, int processes, size_t ringBytes) {
+    ringBytes = (ringBytes + 7) & ~(size_t) 7;
+    for (int i = 0; i < processes; ++i) {
+        auto shard = make_unique<shard_t>();
+        shard->m_memSize = 2 * (sizeof(ring_t) + ringBytes);
+        shard->m_mem = mmap(nullptr, shard->m_memSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shard->m_mem == MAP_FAILED)
+            break;
+        shard->m_req = (ring_t *) shard->m_mem;
+        shard->m_res = (ring_t *) ((uint8_t *) shard->m_mem + sizeof(ring_t) + ringBytes);
+        shard->m_req->Init(ringBytes);
+        shard->m_res->Init(ringBytes);
+        v_shards.push_back(std::move(shard));
+    }
+    // the zygote inherits all the mappings, the solvers it forks find their rings at the same addresses
+    bool zygote = !v_shards.empty() && StartZygote();
+    for (size_t i = 0; i < v_shards.size(); ++i) {
+        if (zygote && SpawnShard(*v_shards[i]))
+            continue;
+        munmap(v_shards[i]->m_mem, v_shards[i]->m_memSize);
+        v_shards.erase(v_shards.begin() + i--);
+    }
+    for (auto & shard : v_shards)
+        shard->m_collector = thread(&CCargoPlanner::CollectShard, this, ref(*shard));
+    // the in-process workers stay as a fallback for the cargo that does not fit a ring
+    Start(sales, v_shards.empty() ? processes : 1);
+}
+
+bool CCargoPlanner::StartZygote() {
+    int cmd[2], reply[2];
+    if (pipe(cmd) != 0)
+        return false;
+    if (pipe(reply) != 0) {
+        close(cmd[0]);
+        close(cmd[1]);
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(cmd[1]);
+        close(reply[0]);
+        ZygoteMain(cmd[0], reply[1]);
+        _exit(0);
+    }
+    close(cmd[0]);
+    close(reply[1]);
+    if (pid < 0) {
+        close(cmd[1]);
+        close(reply[0]);
+        return false;
+    }
+    m_zygotePid = pid;
+    m_zygoteCmd = cmd[1];
+    m_zygoteReply = reply[0];
+    return true;
+}
+
+/**
+ * Forks a solver for every ring pair read from cmd and answers its pid. The command pipe is only closed when the
+ * front process stops the shards or dies, the zygote then ends and its solvers are killed with it. The solvers are
+ * reaped here and each exit is reported on the reply pipe, a pid is reused only after its exit went out, so the front
+ * process reading the pipe in order never mistakes a new solver for a dead one.
+ */
+void CCargoPlanner::ZygoteMain(int cmd, int reply) {
+    while (true) {
+        pollfd pfd {cmd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 100);
+        zygote_msg_t msg {0, 1};
+        while ((msg.m_pid = waitpid(-1, nullptr, WNOHANG)) > 0)
+            if (write(reply, &msg, sizeof(msg)) != (ssize_t) sizeof(msg))
+                return;
+        if (ready == 0 || (ready < 0 && errno == EINTR))
+            continue;
+        ring_t * rings[2];
+        if (read(cmd, rings, sizeof(rings)) != (ssize_t) sizeof(rings))
+            return;
+        pid_t zygote = getpid();
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(cmd);
+            close(reply);
+            // the zygote has a single thread, the signal comes when the whole process is gone
+            #ifdef __linux__
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            #endif /* __linux__ */
+            if (getppid() != zygote)
+                _exit(0);
+            ShardMain(rings[0], rings[1]);
+            _exit(0);
+        }
+        msg = {pid, 0};
+        if (write(reply, &msg, sizeof(msg)) != (ssize_t) sizeof(msg))
+            return;
+    }
+}
+
+bool CCargoPlanner::SpawnShard(shard_t & shard) {
+    ring_t * rings[2] = {shard.m_req, shard.m_res};
+    unique_lock<mutex> ul (m_zygoteMtx);
+    if (m_zygoteCmd < 0 || write(m_zygoteCmd, rings, sizeof(rings)) != (ssize_t) sizeof(rings))
+        return false;
+    // the exits reported before the new pid belong to the old solvers
+    zygote_msg_t msg {-1, 1};
+    while (msg.m_exited) {
+        if (read(m_zygoteReply, &msg, sizeof(msg)) != (ssize_t) sizeof(msg))
+            return false;
+        if (msg.m_exited)
+            MarkExited(msg.m_pid);
+    }
+    if (msg.m_pid < 0)
+        return false;
+    unique_lock<mutex> shardLock (shard.m_mtx);
+    shard.m_pid = msg.m_pid;
+    shard.m_exited = false;
+    return true;
+}
+
+/** Takes the exits the zygote has reported so far, outside SpawnShard the pipe carries nothing else. */
+void CCargoPlanner::ReadExits() {
+    unique_lock<mutex> ul (m_zygoteMtx);
+    if (m_zygoteReply < 0)
+        return;
+    pollfd pfd {m_zygoteReply, POLLIN, 0};
+    zygote_msg_t msg;
+    while (poll(&pfd, 1, 0) > 0 && read(m_zygoteReply, &msg, sizeof(msg)) == (ssize_t) sizeof(msg))
+        MarkExited(msg.m_pid);
+}
+
+/** Called with m_zygoteMtx held, in the order of the pipe the pid still names the solver that has exited. */
+void CCargoPlanner::MarkExited(pid_t pid) {
+    for (auto & shard : v_shards) {
+        unique_lock<mutex> ul (shard->m_mtx);
+        if (shard->m_pid == pid)
+            shard->m_exited = true;
+    }
+}
+
+/** The zygote reaps the solvers and reports their exits, its pid is never checked for after it may be reused. */
+bool CCargoPlanner::ShardExited(shard_t & shard) {
+    ReadExits();
+    unique_lock<mutex> ul (shard.m_mtx);
+    return shard.m_exited;
+}
+
+void CCargoPlanner::ShardMain(ring_t * req, ring_t * res) {
+    vector<uint8_t> record;
+    vector<CCargo> cargo, load;
+    while (req->Get(record, -1)) {
+        record_t header;
+        memcpy(&header, record.data(), sizeof(header));
+        if (header.m_kind == record_t::END) {
+            res->Put(&header, sizeof(header), nullptr, 0, true);
+            return;
+        }
+        const CCargo * items = (const CCargo *) (record.data() + sizeof(header));
+        cargo.assign(items, items + header.m_count);
+        load.clear();
+        SeqSolver(cargo, header.m_maxWeight, header.m_maxVolume, load);
+        header.m_kind = record_t::RESULT;
+        header.m_count = load.size();
+        res->Put(&header, sizeof(header), load.data(), load.size() * sizeof(CCargo), true);
+    }
+}
+
+/** Hands the work to the solver process of its destination, false if it has to be solved in this process. */
+bool CCargoPlanner::ShardWork(const shared_ptr<work_t> & work) {
+    if (v_shards.empty())
+        return false;
+    shard_t & shard = *v_shards[hash<string>()(work->m_ship->Destination()) % v_shards.size()];
+    if (sizeof(record_t) + work->m_cargo->size() * sizeof(CCargo) + 8 > shard.m_req->m_size)
+        return false;
+    uint64_t id = m_nextWorkId++;
+    unique_lock<mutex> ul (shard.m_mtx);
+    // the solver could not be restarted
+    if (shard.m_pid < 0)
+        return false;
+    shard.m_inflight[id] = work;
+    ul.unlock();
+    PutWork(shard, id, *work, true);
+    return true;
+}
+
+bool CCargoPlanner::PutWork(shard_t & shard, uint64_t id, const work_t & work, bool wait) {
+    record_t header {};
+    header.m_kind = record_t::WORK;
+    header.m_id = id;
+    header.m_maxWeight = work.m_ship->MaxWeight();
+    header.m_maxVolume = work.m_ship->MaxVolume();
+    header.m_count = work.m_cargo->size();
+    return shard.m_req->Put(&header, sizeof(header), work.m_cargo->data(), work.m_cargo->size() * sizeof(CCargo), wait);
+}
+
+/**
+ * Front side of a shard, loads the solved ships and restarts the solver process when it dies. Only this thread sends
+ * the solver its END, always behind the resubmitted work of the last restart.
+ */
+void CCargoPlanner::CollectShard(shard_t & shard) {
+    vector<uint8_t> record;
+    vector<CCargo> load;
+    bool ending = false, endSent = false;
+    while (true) {
+        if (!endSent) {
+            unique_lock<mutex> ul (shard.m_mtx);
+            ending = shard.m_ending;
+            ul.unlock();
+            record_t header {};
+            header.m_kind = record_t::END;
+            // a full ring is drained by the solver meanwhile, the next round tries again
+            endSent = ending && shard.m_req->Put(&header, sizeof(header), nullptr, 0, false);
+        }
+        if (!shard.m_res->Get(record, ending && !endSent ? 10 : 100)) {
+            if (ShardExited(shard)) {
+                RestartShard(shard);
+                endSent = false;
+            }
+            if (shard.m_pid < 0)
+                break;
+            continue;
+        }
+        record_t header;
+        memcpy(&header, record.data(), sizeof(header));
+        if (header.m_kind == record_t::END)
+            break;
+        if (header.m_kind != record_t::RESULT)
+            continue;
+        unique_lock<mutex> ul (shard.m_mtx);
+        auto it = shard.m_inflight.find(header.m_id);
+        // a resubmitted work may be answered twice
+        if (it == shard.m_inflight.end())
+            continue;
+        shared_ptr<work_t> work = it->second;
+        shard.m_inflight.erase(it);
+        ul.unlock();
+        const CCargo * items = (const CCargo *) (record.data() + sizeof(header));
+        load.assign(items, items + header.m_count);
+        work->Load(load);
+    }
+    // whatever the solver could not finish (it died after the end mark) is solved here
+    unique_lock<mutex> ul (shard.m_mtx);
+    map<uint64_t, shared_ptr<work_t>> left;
+    left.swap(shard.m_inflight);
+    ul.unlock();
+    for (auto & w : left) {
+        load.clear();
+        SeqSolver(*w.second->m_cargo, w.second->m_ship->MaxWeight(), w.second->m_ship->MaxVolume(), load);
+        w.second->Load(load);
+    }
+}
+
+void CCargoPlanner::RestartShard(shard_t & shard) {
+    #ifdef DEBUG_PRINT
+    printf("Shard %d died, restarting\n", shard.m_pid);
+    #endif /* DEBUG_PRINT */
+    // the new process starts from empty rings, everything in flight is submitted again
+    shard.m_req->Reset();
+    shard.m_res->Reset();
+    shard.m_restarts++;
+    if (!SpawnShard(shard)) {
+        unique_lock<mutex> ul (shard.m_mtx);
+        shard.m_pid = -1;
+        return;
+    }
+    unique_lock<mutex> ul (shard.m_mtx);
+    vector<pair<uint64_t, shared_ptr<work_t>>> inflight (shard.m_inflight.begin(), shard.m_inflight.end());
+    ul.unlock();
+    vector<uint8_t> record;
+    for (auto & w : inflight) {
+        // this thread is the only reader of the results, keep them flowing while the requests do not fit
+        while (!PutWork(shard, w.first, *w.second, false)) {
+            if (!shard.m_res->Get(record, 10)) {
+                // the new solver is gone too, the collector restarts it once more
+                if (ShardExited(shard))
+                    return;
+                continue;
+            }
+            record_t header;
+            memcpy(&header, record.data(), sizeof(header));
+            if (header.m_kind != record_t::RESULT)
+                continue;
+            unique_lock<mutex> inflightLock (shard.m_mtx);
+            auto it = shard.m_inflight.find(header.m_id);
+            if (it == shard.m_inflight.end())
+                continue;
+            shared_ptr<work_t> work = it->second;
+            shard.m_inflight.erase(it);
+            inflightLock.unlock();
+            const CCargo * items = (const CCargo *) (record.data() + sizeof(header));
+            work->Load(vector<CCargo>(items, items + header.m_count));
+        }
+    }
+}
+
+void CCargoPlanner::StopShards() {
+    for (auto & shard : v_shards) {
+        unique_lock<mutex> ul (shard->m_mtx);
+        shard->m_ending = true;
+        ul.unlock();
+        // a full ring is fine, the collector is busy then and sees m_ending on its next record
+        record_t header {};
+        header.m_kind = record_t::STOP;
+        shard->m_res->Put(&header, sizeof(header), nullptr, 0, false);
+    }
+    for (auto & shard : v_shards) {
+        shard->m_collector.join();
+        munmap(shard->m_mem, shard->m_memSize);
+    }
+    v_shards.clear();
+    // the zygote ends on the closed pipe
+    if (m_zygotePid >= 0) {
+        close(m_zygoteCmd);
+        close(m_zygoteReply);
+        waitpid(m_zygotePid, nullptr, 0);
+        m_zygotePid = m_zygoteCmd = m_zygoteReply = -1;
+    }
+}
+
+void ring_t::Init(uint64_t size) {
+    pthread_mutexattr_t mtxAttr;
+    pthread_mutexattr_init(&mtxAttr);
+    pthread_mutexattr_setpshared(&mtxAttr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mtxAttr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&m_mtx, &mtxAttr);
+    pthread_mutexattr_destroy(&mtxAttr);
+    sem_init(&m_notEmpty, 1, 0);
+    sem_init(&m_notFull, 1, 0);
+    m_emptyWaiters = m_fullWaiters = 0;
+    m_head = m_tail = 0;
+    m_size = size;
+}
+
+void ring_t::Lock() {
+    // the records are published by moving m_head / m_tail as the last step, a dead owner leaves no torn record
+    if (pthread_mutex_lock(&m_mtx) == EOWNERDEAD)
+        pthread_mutex_consistent(&m_mtx);
+}
+
+/** Waits with the ring locked until woken or past the deadline (none for ever), false on the timeout. */
+bool ring_t::Wait(sem_t & sem, uint32_t & waiters, const timespec * deadline) {
+    waiters++;
+    Unlock();
+    int res;
+    do
+        res = deadline ? sem_timedwait(&sem, deadline) : sem_wait(&sem);
+    while (res != 0 && errno == EINTR);
+    Lock();
+    // a post that came too late stays in the semaphore, the next waiter just checks the ring once more
+    if (res != 0 && waiters > 0)
+        waiters--;
+    return res == 0;
+}
+
+/** Wakes everyone waiting, a waiter that died in the meantime only leaves a spurious wake up behind. */
+void ring_t::Wake(sem_t & sem, uint32_t & waiters) {
+    for (; waiters > 0; waiters--)
+        sem_post(&sem);
+}
+
+void ring_t::Reset() {
+    Lock();
+    m_head = m_tail = 0;
+    Wake(m_notFull, m_fullWaiters);
+    Unlock();
+}
+
+bool ring_t::Put(const void * header, size_t headerLen, const void * body, size_t bodyLen, bool wait) {
+    uint64_t len = (headerLen + bodyLen + 7) & ~(uint64_t) 7;
+    Lock();
+    while (true) {
+        // a drained ring starts over from the beginning, any record up to m_size fits then
+        if (m_head == m_tail)
+            m_head = m_tail = 0;
+        uint64_t offset = m_head % m_size;
+        // a record does not wrap, the rest of the ring is skipped with a pad record if it is too short
+        uint64_t pad = offset + len > m_size ? m_size - offset : 0;
+        if (m_head + pad + len - m_tail <= m_size) {
+            if (pad) {
+                uint32_t padHeader[2] = {(uint32_t) pad, record_t::PAD};
+                memcpy(Data() + offset, padHeader, sizeof(padHeader));
+                offset = 0;
+            }
+            memcpy(Data() + offset, header, headerLen);
+            uint32_t recordLen = headerLen + bodyLen;
+            memcpy(Data() + offset, &recordLen, sizeof(recordLen));
+            if (bodyLen)
+                memcpy(Data() + offset + headerLen, body, bodyLen);
+            m_head += pad + len;
+            Wake(m_notEmpty, m_emptyWaiters);
+            Unlock();
+            return true;
+        }
+        if (!wait) {
+            Unlock();
+            return false;
+        }
+        Wait(m_notFull, m_fullWaiters, nullptr);
+    }
+}
+
+bool ring_t::Get(vector<uint8_t> & record, int timeoutMs) {
+    // sem_timedwait counts in the real time
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    Lock();
+    while (true) {
+        while (m_head != m_tail) {
+            uint64_t offset = m_tail % m_size;
+            uint32_t header[2];
+            memcpy(header, Data() + offset, sizeof(header));
+            uint64_t len = (header[0] + 7) & ~(uint64_t) 7;
+            if (header[1] == record_t::PAD) {
+                m_tail += header[0];
+                continue;
+            }
+            record.assign(Data() + offset, Data() + offset + header[0]);
+            m_tail += len;
+            Wake(m_notFull, m_fullWaiters);
+            Unlock();
+            return true;
+        }
+        if (!Wait(m_notEmpty, m_emptyWaiters, timeoutMs < 0 ? nullptr : &deadline)) {
+            Unlock();
+            return false;
+        }
+    }
+}
+
+/** Pins the calling thread to one core of the set, threads must pin themselves before touching their memory.
+ *  A thread that cannot be pinned (offline core, cgroup without it) keeps running unpinned, false then. */
+bool CCargoPlanner::PinThread(const vector<int> & cpus, int tid) {
+    if (cpus.empty())
+        return true;
+    #ifdef __linux__
+    int cpu = cpus[tid % cpus.size()];
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        fprintf(stderr, "PinThread: thread %d: cpu %d out of range\n", tid, cpu);
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        fprintf(stderr, "PinThread: thread %d: cpu %d: %s\n", tid, cpu, strerror(err));
+        return false;
+    }
+    #endif /* __linux__ */
+    return true;
+}
+
+/** Lists the cores of a NUMA node as reported by sysfs, empty if the node does not exist. */
+vector<int> placement_t::NodeCpus(int node) {
+    vector<int> cpus;
+    ifstream in ("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    string range;
+    // the list looks like "0-7,16-23", a node without cores has an empty line
+    while (getline(in, range, ',')) {
+        int from, to;
+        int fields = sscanf(range.c_str(), "%d-%d", &from, &to);
+        if (fields < 1 || from < 0)
+            continue;
+        if (fields == 1)
+            to = from;
+        for (int cpu = from; cpu <= to; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+/** Solves the knapsack by the cell width the fee bound of the work needs: the sum of the fees that can be taken at all
+ *  picks 16, 32 or 64 bit cells. Without such a fee the load stays empty and no table is built. Negative sizes and
+ *  tables of the choices or of the fees that do not fit the limits below go to ProgtestSolver. */
 int CCargoPlanner::SeqSolver(const vector<CCargo> &cargo, int maxWeight, int maxVolume, vector<CCargo> &load) {
-    return ProgtestSolver(cargo, maxWeight, maxVolume, load);
+    const uint64_t maxBits = uint64_t(1) << 30;    // 128 MiB of recorded choices
+    const uint64_t maxBest = uint64_t(1) << 27;    // 128 MiB of fees
+    if (maxWeight < 0 || maxVolume < 0)
+        return ProgtestSolver(cargo, maxWeight, maxVolume, load);
+    uint64_t bound = 0;
+    for (const CCargo & c : cargo) {
+        if (c.m_Weight < 0 || c.m_Volume < 0)
+            return ProgtestSolver(cargo, maxWeight, maxVolume, load);
+        if (c.m_Fee > 0 && c.m_Weight <= maxWeight && c.m_Volume <= maxVolume)
+            bound += c.m_Fee;
+    }
+    if (!bound)
+        return 0;
+    // the same shapes as SeqSolverDP allocates, divided so that no product overflows
+    const uint64_t rows = uint64_t(maxWeight) + 1, cols = uint64_t(maxVolume) + 1;
+    const uint64_t cell = bound <= UINT16_MAX ? sizeof(uint16_t) : bound <= UINT32_MAX ? sizeof(uint32_t) : sizeof(uint64_t);
+    if (rows * ((cols + 63) / 64 * 64) > maxBits / cargo.size() || rows * (cols + 64) > maxBest / cell)
+        return ProgtestSolver(cargo, maxWeight, maxVolume, load);
+    if (cell == sizeof(uint16_t))
+        return SeqSolverDP<uint16_t>(cargo, maxWeight, maxVolume, load);
+    if (cell == sizeof(uint32_t))
+        return SeqSolverDP<uint32_t>(cargo, maxWeight, maxVolume, load);
+    return SeqSolverDP<uint64_t>(cargo, maxWeight, maxVolume, load);
+}
+
+/** Adds the fee to 64 cells of from and keeps the sums that beat row, returns a bit per cell that was beaten. */
+template <typename T>
+static inline uint64_t SeqSolverBlock(T * __restrict__ row, const T * __restrict__ from, T fee) {
+    uint8_t better[64];
+    for (size_t v = 0; v < 64; ++v) {
+        const T fee2 = T(from[v] + fee);
+        better[v] = fee2 > row[v];
+        row[v] = fee2 > row[v] ? fee2 : row[v];
+    }
+    // eight flags of one byte each to eight bits
+    uint64_t mask = 0;
+    for (size_t b = 0; b < 8; ++b) {
+        uint64_t flags;
+        memcpy(&flags, better + b * 8, 8);
+        mask |= (flags * 0x0102040810204080ULL) >> 56 << (b * 8);
+    }
+    return mask;
+}
+
+/** 0/1 knapsack over weight and volume, T has to hold the sum of the fees. One table of the best fee per (weight,
+ *  volume) is updated in place item by item, a bit per item and cell records whether the item improved the cell and
+ *  the load is then read back from the full ship. A row is updated 64 cells at a time without branches, so the
+ *  compiler vectorizes it and narrower cells fit more of them per register. The bits of an item are kept from its
+ *  volume on and the rows have 64 cells of padding, the blocks then need no bounds checks. The fee is clamped to
+ *  INT_MAX, the load is exact. */
+template <typename T>
+int CCargoPlanner::SeqSolverDP(const vector<CCargo> &cargo, int maxWeight, int maxVolume, vector<CCargo> &load) {
+    const size_t rows = size_t(maxWeight) + 1, cols = size_t(maxVolume) + 1, stride = cols + 64, words = (cols + 63) / 64;
+    vector<T> best(rows * stride, 0), same;
+    vector<uint64_t> taken(cargo.size() * rows * words, 0);
+    for (size_t i = 0; i < cargo.size(); ++i) {
+        const CCargo & c = cargo[i];
+        if (c.m_Fee <= 0 || c.m_Weight > maxWeight || c.m_Volume > maxVolume)
+            continue;
+        const T fee = T(c.m_Fee);
+        const size_t weight = c.m_Weight, volume = c.m_Volume;
+        // rows run downwards so the row read still holds the fees without this item, without weight it is the same row
+        for (size_t w = rows; w-- > weight; ) {
+            T * row = &best[w * stride] + volume;
+            const T * from = &best[(w - weight) * stride];
+            if (!weight) {
+                same.assign(from, from + stride);
+                from = same.data();
+            }
+            uint64_t * bits = &taken[(i * rows + w) * words];
+            for (size_t word = 0; word * 64 < cols - volume; ++word, row += 64, from += 64)
+                bits[word] = SeqSolverBlock(row, from, fee);
+        }
+    }
+    size_t w = maxWeight, v = maxVolume, first = load.size();
+    for (size_t i = cargo.size(); i-- > 0; ) {
+        const size_t volume = cargo[i].m_Volume;
+        if (cargo[i].m_Fee <= 0 || cargo[i].m_Weight > int(w) || volume > v)
+            continue;
+        if (taken[(i * rows + w) * words + (v - volume) / 64] >> ((v - volume) & 63) & 1) {
+            load.push_back(cargo[i]);
+            w -= cargo[i].m_Weight;
+            v -= volume;
+        }
+    }
+    reverse(load.begin() + first, load.end());
+    return int(min<uint64_t>(best[maxWeight * stride + maxVolume], INT_MAX));
 }
 
 void CCargoPlanner::InsertSale(const shared_ptr<sale_t> & sale){
@@ -175,6 +1565,8 @@ shared_ptr<sale_t> CCargoPlanner::RemoveSale(int tid){
 }
 
 void CCargoPlanner::InsertWork(const shared_ptr<work_t> & work) {
+    if (!work->m_end && ShardWork(work))
+        return;
     unique_lock<mutex> ul (m_workMtx);
     q_work.push_back(work);
     #ifdef DEBUG_PRINT
@@ -189,7 +1581,9 @@ void CCargoPlanner::InsertWork(const shared_ptr<work_t> & work) {
 shared_ptr<work_t> CCargoPlanner::RemoveWork(int tid) {
     shared_ptr<work_t> work;
     unique_lock<mutex> ul (m_workMtx);
+    m_idleWorkers++;
     cv_emptyWorkQ.wait(ul, [ this ] () { return ( ! q_work.empty() ); } );
+    m_idleWorkers--;
     work = q_work.front();
     q_work.pop_front();
     #ifdef DEBUG_PRINT
@@ -206,31 +1600,43 @@ void salesThread(int tid, CCargoPlanner * cargoPlanner){
     #ifdef DEBUG_PRINT
     printf("Sales thread %d start.\n", tid);
     #endif /* DEBUG_PRINT */
+    CCargoPlanner::PinThread(cargoPlanner->m_placement.v_salesCpus, tid);
     while (true) {
         shared_ptr<sale_t> sale = cargoPlanner->RemoveSale(tid);
         // if the sale is an indicator to end this thread break the loop and end this thread
         if (sale->m_end)
             break;
+        // a coroutine sale with all its quotes answered
+        if (sale->m_resume) {
+            sale->m_resume.resume();
+            continue;
+        }
+        if (cargoPlanner->m_asyncSales) {
+            CCargoPlanner::SellShip(cargoPlanner, sale);
+            continue;
+        }
         // else do sale
         vector<CCargo> allCargoToLoad;
-        vector<CCargo> temporaryCargo;
-        for (auto & c : cargoPlanner->v_customers) {
-            c->Quote(sale->m_ship->Destination(), temporaryCargo);
-            allCargoToLoad.insert(allCargoToLoad.end(),temporaryCargo.begin(), temporaryCargo.end());
-            temporaryCargo.clear();
-        }
-        work_t work(tid, make_shared<vector<CCargo>>(allCargoToLoad), sale->m_ship, false);
+        cargoPlanner->QuoteAll(sale->m_ship->Destination(), allCargoToLoad);
+        work_t work(tid, make_shared<vector<CCargo>>(allCargoToLoad), sale->m_ship, false, sale->m_done);
         cargoPlanner->InsertWork(make_shared<work_t>(work));
     }
     // producer exit sequence
-    int var;
+    int var, workers;
+    bool stopping;
     unique_lock<mutex> uniqueLock(cargoPlanner->m_runningMtx);
-    cargoPlanner->m_runningSales--;
-    var = cargoPlanner->m_runningSales;
+    cargoPlanner->m_liveSales--;
+    var = cargoPlanner->m_liveSales;
+    stopping = cargoPlanner->m_stopping;
+    workers = cargoPlanner->m_runningWorkers;
+    if (var == 0 && stopping)
+        cargoPlanner->m_runningWorkers = 0;
+    else
+        cargoPlanner->v_retiredSales.push_back(tid);
     uniqueLock.unlock();
     // if this thread is the last running sales thread, create ending messages for the rest of the running workers.
-    if (var == 0){
-        for (int i = 0; i < cargoPlanner->m_runningWorkers; ++i) {
+    if (var == 0 && stopping){
+        for (int i = 0; i < workers; ++i) {
             work_t work_end(tid, nullptr, nullptr, true);
             cargoPlanner->InsertWork(make_shared<work_t>(work_end));
         }
@@ -244,20 +1650,64 @@ void workThread(int tid, CCargoPlanner * cargoPlanner){
     #ifdef DEBUG_PRINT
     printf("Work thread %d start.\n", tid);
     #endif /* DEBUG_PRINT */
+    CCargoPlanner::PinThread(cargoPlanner->m_placement.v_workerCpus, tid);
+    // scratch buffers live for the whole thread, they are first touched here, i.e. on the worker's own node
+    vector<CCargo> cargo;
+    vector<CCargo> load;
+    bool localCargo = cargoPlanner->m_placement.m_localCargo && !cargoPlanner->m_placement.v_workerCpus.empty();
     while (true) {
         shared_ptr<work_t> work = cargoPlanner->RemoveWork(tid);
         // if the thread has received a message to end
         if (work->m_end)
             break;
         // CCargoPlanner::SeqSolver(const vector<CCargo> &cargo, int maxWeight, int maxVolume, vector<CCargo> &load)
-        vector<CCargo> load;
-        cargoPlanner->SeqSolver(*(work->m_cargo), work->m_ship->MaxWeight(), work->m_ship->MaxVolume(), load);
-        work->m_ship->Load(load);
+        load.clear();
+        if (localCargo) {
+            cargo.assign(work->m_cargo->begin(), work->m_cargo->end());
+            cargoPlanner->SeqSolver(cargo, work->m_ship->MaxWeight(), work->m_ship->MaxVolume(), load);
+        } else
+            cargoPlanner->SeqSolver(*(work->m_cargo), work->m_ship->MaxWeight(), work->m_ship->MaxVolume(), load);
+        work->Load(load);
     }
+    // a retired worker waits for ReapThreads, the rest are joined in Stop
+    unique_lock<mutex> uniqueLock(cargoPlanner->m_runningMtx);
+    if (!cargoPlanner->m_stopping)
+        cargoPlanner->v_retiredWorkers.push_back(tid);
+    uniqueLock.unlock();
     #ifdef DEBUG_PRINT
     printf("work thread %d end.\n", tid);
     #endif /* DEBUG_PRINT */
 }
+
+void scaleThread(CCargoPlanner * cargoPlanner){
+    const autoscale_t & scale = *cargoPlanner->m_scale;
+    int deepTicks = 0, idleTicks = 0;
+    unique_lock<mutex> ul (cargoPlanner->m_scaleMtx);
+    while (!cargoPlanner->cv_scaleStop.wait_for(ul, scale.m_interval, [ cargoPlanner ] () { return cargoPlanner->m_scaleStop; } )) {
+        ul.unlock();
+        unique_lock<mutex> workLock (cargoPlanner->m_workMtx);
+        size_t depth = cargoPlanner->q_work.size();
+        int idle = cargoPlanner->m_idleWorkers;
+        workLock.unlock();
+        unique_lock<mutex> runningLock (cargoPlanner->m_runningMtx);
+        int workers = cargoPlanner->m_runningWorkers;
+        runningLock.unlock();
+        // the queue is deep if every worker has at least one more job waiting behind its current one
+        deepTicks = depth > (size_t) workers ? deepTicks + 1 : 0;
+        idleTicks = depth == 0 && idle > 1 ? idleTicks + 1 : 0;
+        if (deepTicks >= scale.m_ticks && workers < scale.m_maxWorkers) {
+            cargoPlanner->AddWorkers(1);
+            deepTicks = 0;
+        } else if (idleTicks >= scale.m_ticks && workers > scale.m_minWorkers) {
+            cargoPlanner->RemoveWorkers(1);
+            idleTicks = 0;
+        }
+        #ifdef DEBUG_PRINT
+        printf("Autoscaler: depth %zu, idle %d, workers %d\n", depth, idle, workers);
+        #endif /* DEBUG_PRINT */
+        ul.lock();
+    }
+}
 ////--------------------------------------------------------------------------------------------------------------------
 #ifndef __PROGTEST__
 
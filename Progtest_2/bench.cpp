@@ -0,0 +1,281 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+using namespace std;
+
+// microbenchmarks of the memory manager, results go to stdout as JSON:
+//   bench [totalPages [pages [reps]]]
+// totalPages - memory given to MemMgr, pages - memory of one process, reps - repetitions of each measured operation
+// every benchmark runs with eager and with lazy allocation
+
+struct TParams
+{
+  uint32_t            m_TotalPages;
+  uint32_t            m_Pages;
+  uint32_t            m_Reps;
+  bool                m_Lazy;
+};
+
+static TParams         g_Params = { 16 * 1024, 1024, 200, false };
+static bool            g_FirstResult = true;
+
+static double      now                                     ( void )
+{
+  timespec t;
+  clock_gettime ( CLOCK_MONOTONIC, &t );
+  return t . tv_sec + t . tv_nsec * 1e-9;
+}
+
+static uint32_t    nextRandom                              ( uint32_t        & state )
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static int         cmpDouble                               ( const void      * a,
+                                                             const void      * b )
+{
+  double x = * (const double *) a, y = * (const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void        result                                  ( const char      * name,
+                                                             const char      * param,
+                                                             uint32_t          value,
+                                                             const char      * metric,
+                                                             double            amount,
+                                                             const char      * unit )
+{
+  printf ( "%s\n    {\"name\": \"%s\", \"lazy\": %s, \"%s\": %u, \"metric\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}",
+           g_FirstResult ? "" : ",", name, g_Params . m_Lazy ? "true" : "false", param, value, metric, amount, unit );
+  g_FirstResult = false;
+}
+
+static void        fail                                    ( const char      * what )
+{
+  fprintf ( stderr, "bench: %s failed\n", what );
+  exit ( 1 );
+}
+
+// waits until only the calling process is left, the memory of the others is free again by then
+static void        waitChildren                            ( void )
+{
+  TMemStats stats;
+  while ( MemMgrStats ( stats, NULL, 0 ) > 1 )
+    usleep ( 100 );
+}
+
+//-------------------------------------------------------------------------------------------------
+// SetMemLimit growing to m_Pages and shrinking back to 0
+
+static void        limitBench                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  double start = now ();
+  for ( uint32_t i = 0; i < g_Params . m_Reps; i ++ )
+    if ( ! cpu -> SetMemLimit ( g_Params . m_Pages ) || ! cpu -> SetMemLimit ( 0 ) )
+      fail ( "SetMemLimit" );
+  double time = now () - start;
+  result ( "set_mem_limit", "pages", g_Params . m_Pages, "grow_shrink_per_s", g_Params . m_Reps / time, "1/s" );
+  result ( "set_mem_limit", "pages", g_Params . m_Pages, "pages_per_s", 2.0 * g_Params . m_Pages * g_Params . m_Reps / time, "1/s" );
+}
+
+//-------------------------------------------------------------------------------------------------
+// NewProcess with copyMem of a process with m_Pages written pages: the call itself and until the child runs
+
+struct TForkArg
+{
+  sem_t               m_Started;
+  double              m_StartTime;
+};
+
+static void        forkChild                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TForkArg * fork = (TForkArg *) arg;
+  fork -> m_StartTime = now ();
+  sem_post ( &fork -> m_Started );
+}
+
+static void        forkBench                               ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t reps = g_Params . m_Reps;
+  double * call = new double [reps], * start = new double [reps];
+  TForkArg fork;
+  sem_init ( &fork . m_Started, 0, 0 );
+  if ( ! cpu -> SetMemLimit ( g_Params . m_Pages ) )
+    fail ( "SetMemLimit" );
+  for ( uint32_t p = 0; p < g_Params . m_Pages; p ++ )
+    cpu -> WriteInt ( p * CCPU::PAGE_SIZE, p );
+  for ( uint32_t i = 0; i < reps; i ++ )
+  {
+    double t0 = now ();
+    if ( ! cpu -> NewProcess ( &fork, forkChild, true ) )
+      fail ( "NewProcess" );
+    call[i] = now () - t0;
+    sem_wait ( &fork . m_Started );
+    start[i] = fork . m_StartTime - t0;
+    // the child has to be gone before the next fork, its memory is needed again
+    waitChildren ();
+  }
+  qsort ( call, reps, sizeof ( double ), cmpDouble );
+  qsort ( start, reps, sizeof ( double ), cmpDouble );
+  result ( "fork", "pages", g_Params . m_Pages, "call_p50", call[reps / 2] * 1e6, "us" );
+  result ( "fork", "pages", g_Params . m_Pages, "call_p99", call[reps * 99 / 100] * 1e6, "us" );
+  result ( "fork", "pages", g_Params . m_Pages, "child_start_p50", start[reps / 2] * 1e6, "us" );
+  result ( "fork", "pages", g_Params . m_Pages, "child_start_p99", start[reps * 99 / 100] * 1e6, "us" );
+  sem_destroy ( &fork . m_Started );
+  delete [] call;
+  delete [] start;
+  cpu -> SetMemLimit ( 0 );
+}
+
+//-------------------------------------------------------------------------------------------------
+// ReadInt / WriteInt over m_Pages pages, sequentially by words and at random words
+
+static uint32_t    accessLoop                              ( CCPU            * cpu,
+                                                             uint32_t          pages,
+                                                             uint32_t          ops,
+                                                             bool              random,
+                                                             uint32_t          seed )
+{
+  uint32_t words = pages * ( CCPU::PAGE_SIZE / 4 ), state = seed | 1, sum = 0, value;
+  for ( uint32_t i = 0; i < ops; i ++ )
+  {
+    uint32_t word = random ? nextRandom ( state ) % words : i % words;
+    if ( i & 1 )
+    {
+      if ( ! cpu -> ReadInt ( word * 4, value ) )
+        fail ( "ReadInt" );
+      sum += value;
+    }
+    else if ( ! cpu -> WriteInt ( word * 4, i ) )
+      fail ( "WriteInt" );
+  }
+  return sum;
+}
+
+static void        accessBench                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t ops = g_Params . m_Reps * 10000;
+  if ( ! cpu -> SetMemLimit ( g_Params . m_Pages ) )
+    fail ( "SetMemLimit" );
+  // the first pass maps lazy pages
+  accessLoop ( cpu, g_Params . m_Pages, g_Params . m_Pages * ( CCPU::PAGE_SIZE / 4 ), false, 1 );
+  for ( int random = 0; random < 2; random ++ )
+  {
+    double start = now ();
+    accessLoop ( cpu, g_Params . m_Pages, ops, random, 1 );
+    result ( random ? "access_random" : "access_sequential", "pages", g_Params . m_Pages, "ops_per_s",
+             ops / ( now () - start ), "1/s" );
+  }
+  cpu -> SetMemLimit ( 0 );
+}
+
+//-------------------------------------------------------------------------------------------------
+// random accesses of 1 .. PROCESS_MAX processes at once, each to its own memory
+
+struct TScaleArg
+{
+  pthread_barrier_t * m_Barrier;
+  uint32_t            m_Pages;
+  uint32_t            m_Ops;
+  uint32_t            m_Seed;
+};
+
+static void        scaleWorker                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TScaleArg * scale = (TScaleArg *) arg;
+  bool ok = cpu -> SetMemLimit ( scale -> m_Pages );
+  if ( ok )
+    accessLoop ( cpu, scale -> m_Pages, scale -> m_Pages * ( CCPU::PAGE_SIZE / 4 ), false, scale -> m_Seed );
+  pthread_barrier_wait ( scale -> m_Barrier );
+  if ( ok )
+    accessLoop ( cpu, scale -> m_Pages, scale -> m_Ops, true, scale -> m_Seed );
+  pthread_barrier_wait ( scale -> m_Barrier );
+  if ( ! ok )
+    fail ( "SetMemLimit" );
+  cpu -> SetMemLimit ( 0 );
+}
+
+static void        scaleBench                              ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  static TScaleArg args[PROCESS_MAX];
+  uint32_t ops = g_Params . m_Reps * 1000;
+  for ( uint32_t procs = 1; procs <= PROCESS_MAX; procs *= 2 )
+  {
+    // the processes share the memory, with room left for page tables and caches
+    uint32_t pages = ( g_Params . m_TotalPages - 512 ) / procs * 3 / 4;
+    if ( pages > g_Params . m_Pages )
+      pages = g_Params . m_Pages;
+    pthread_barrier_t barrier;
+    pthread_barrier_init ( &barrier, NULL, procs + 1 );
+    for ( uint32_t i = 0; i < procs; i ++ )
+    {
+      args[i] . m_Barrier = &barrier;
+      args[i] . m_Pages = pages;
+      args[i] . m_Ops = ops;
+      args[i] . m_Seed = i + 1;
+      if ( ! cpu -> NewProcess ( &args[i], scaleWorker, false ) )
+        fail ( "NewProcess" );
+    }
+    pthread_barrier_wait ( &barrier );
+    double start = now ();
+    pthread_barrier_wait ( &barrier );
+    double time = now () - start;
+    result ( "scaling", "processes", procs, "ops_per_s", (double) ops * procs / time, "1/s" );
+    // the workers leave the barrier before they end, the next round waits for their memory
+    waitChildren ();
+    pthread_barrier_destroy ( &barrier );
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+int                main                                    ( int               argc,
+                                                             char            * argv [] )
+{
+  if ( argc > 1 ) g_Params . m_TotalPages = atoi ( argv[1] );
+  if ( argc > 2 ) g_Params . m_Pages = atoi ( argv[2] );
+  if ( argc > 3 ) g_Params . m_Reps = atoi ( argv[3] );
+  if ( g_Params . m_TotalPages < 1024 || g_Params . m_Pages == 0 || g_Params . m_Reps == 0
+       || 2 * g_Params . m_Pages + 512 > g_Params . m_TotalPages )
+  {
+    fprintf ( stderr, "usage: %s [totalPages >= 2 * pages + 512 [pages [reps]]]\n", argv[0] );
+    return 1;
+  }
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ g_Params . m_TotalPages * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  void ( * benchmarks[] ) ( CCPU *, void * ) = { limitBench, forkBench, accessBench, scaleBench };
+
+  printf ( "{\n  \"total_pages\": %u, \"pages\": %u, \"reps\": %u,\n  \"results\": [",
+           g_Params . m_TotalPages, g_Params . m_Pages, g_Params . m_Reps );
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    MemMgrConfig ( config );
+    g_Params . m_Lazy = lazy;
+    for ( auto benchmark : benchmarks )
+      MemMgr ( memAligned, g_Params . m_TotalPages, NULL, benchmark );
+  }
+  printf ( "\n  ]\n}\n" );
+  delete [] mem;
+  return 0;
+}
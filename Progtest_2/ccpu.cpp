@@ -15,15 +15,24 @@ using namespace std;
 CCPU::CCPU(uint8_t *memStart, uint32_t pageTableRoot) {
     m_MemStart = memStart;
     m_PageTableRoot = pageTableRoot;
+    m_TableShared = false;
+    m_TableDepth = 0;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m_TableMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    tlbFlush();
 }
 
 //-------------------------------------------------------------------------------------------------
 bool CCPU::ReadInt(uint32_t address, uint32_t &value) {
     if (address & 0x3) return false; // not aligned
+    tableLock();
     uint32_t *addr = virtual2Physical(address, false);
-    if (!addr) return false;
-    value = *addr;
-    return true;
+    if (addr) value = *addr;
+    tableUnlock();
+    return addr != NULL;
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -31,19 +40,85 @@ bool CCPU::WriteInt(uint32_t address, uint32_t value) {
     if (address & 0x3){
        return false;
     }
+    tableLock();
     uint32_t *addr = virtual2Physical(address, true);
-    if (!addr){
-        return false;
+    if (addr){
+        *addr = value;
     }
-    *addr = value;
-    return true;
+    tableUnlock();
+    return addr != NULL;
+}
+
+//-------------------------------------------------------------------------------------------------
+uint32_t CCPU::ReadBlock(uint32_t address, void *data, uint32_t size) {
+    uint32_t done = 0;
+    if (address && size > 0 - address) size = 0 - address; // a block never wraps around the end of the address space
+    tableLock();
+    while (done < size) {
+        uint32_t chunk = blockChunk(address + done, size - done);
+        uint32_t *src = virtual2Physical(address + done, false);
+        if (!src) break;
+        memcpy((uint8_t *) data + done, src, chunk);
+        done += chunk;
+    }
+    tableUnlock();
+    return done;
+}
+
+//-------------------------------------------------------------------------------------------------
+uint32_t CCPU::WriteBlock(uint32_t address, const void *data, uint32_t size) {
+    uint32_t done = 0;
+    if (address && size > 0 - address) size = 0 - address; // a block never wraps around the end of the address space
+    tableLock();
+    while (done < size) {
+        uint32_t chunk = blockChunk(address + done, size - done);
+        uint32_t *dst = virtual2Physical(address + done, true);
+        if (!dst) break;
+        memcpy(dst, (const uint8_t *) data + done, chunk);
+        done += chunk;
+    }
+    tableUnlock();
+    return done;
+}
+
+//-------------------------------------------------------------------------------------------------
+uint32_t CCPU::FillBlock(uint32_t address, uint8_t value, uint32_t size) {
+    uint32_t done = 0;
+    if (address && size > 0 - address) size = 0 - address; // a block never wraps around the end of the address space
+    tableLock();
+    while (done < size) {
+        uint32_t chunk = blockChunk(address + done, size - done);
+        uint32_t *dst = virtual2Physical(address + done, true);
+        if (!dst) break;
+        memset(dst, value, chunk);
+        done += chunk;
+    }
+    tableUnlock();
+    return done;
+}
+
+//-------------------------------------------------------------------------------------------------
+uint32_t CCPU::blockChunk(uint32_t address, uint32_t size) const {
+    // the rest of the block or of the page, whichever ends first
+    uint32_t left = PAGE_SIZE - (address & ~ADDR_MASK);
+    return size < left ? size : left;
 }
 
 //-------------------------------------------------------------------------------------------------
 uint32_t *CCPU::virtual2Physical(uint32_t address, bool write) {
     const uint32_t reqMask = BIT_PRESENT | BIT_USER | (write ? BIT_WRITE : 0);
     const uint32_t orMask = BIT_REFERENCED | (write ? BIT_DIRTY : 0);
+    TTlbEntry &tlb = m_Tlb[(address >> OFFSET_BITS) % TLB_ENTRIES];
 
+    // the referenced bit was set when the entry was filled, dirty is set once on the first write
+    if (tlb.m_Tag == (address >> OFFSET_BITS) + 1 && (!write || tlb.m_Write)) {
+        if (write && !tlb.m_Dirty) {
+            *tlb.m_Level1 |= BIT_DIRTY;
+            *tlb.m_Level2 |= BIT_DIRTY;
+            tlb.m_Dirty = true;
+        }
+        return (uint32_t *) (tlb.m_Frame + (address & ~ADDR_MASK));
+    }
 
     while (1) {
         uint32_t *level1 = (uint32_t *) (m_MemStart + (m_PageTableRoot & ADDR_MASK)) + (address >> 22);
@@ -52,17 +127,42 @@ uint32_t *CCPU::virtual2Physical(uint32_t address, bool write) {
             if (pageFaultHandler(address, write)) continue;
             return NULL;
         }
-        uint32_t *level2 =
-                (uint32_t *) (m_MemStart + (*level1 & ADDR_MASK)) + ((address >> OFFSET_BITS) & (PAGE_DIR_ENTRIES - 1));
+        // a large page entry stands for both levels
+        uint32_t *level2 = level1;
+        uint32_t frameAddr;
+        if (*level1 & BIT_LARGE)
+            frameAddr = (*level1 & LARGE_ADDR_MASK) | (address & ~LARGE_ADDR_MASK & ADDR_MASK);
+        else {
+            level2 = (uint32_t *) (m_MemStart + (*level1 & ADDR_MASK)) + ((address >> OFFSET_BITS) & (PAGE_DIR_ENTRIES - 1));
 
-        if ((*level2 & reqMask) != reqMask) {
-            if (pageFaultHandler(address, write)) continue;
-            return NULL;
+            if ((*level2 & reqMask) != reqMask) {
+                if (pageFaultHandler(address, write)) continue;
+                return NULL;
+            }
+            frameAddr = *level2 & ADDR_MASK;
         }
         *level1 |= orMask;
         *level2 |= orMask;
-        return (uint32_t *) (m_MemStart + (*level2 & ADDR_MASK) + (address & ~ADDR_MASK));
+        tlb.m_Tag = (address >> OFFSET_BITS) + 1;
+        tlb.m_Level1 = level1;
+        tlb.m_Level2 = level2;
+        tlb.m_Frame = m_MemStart + frameAddr;
+        tlb.m_Write = (*level1 & *level2 & BIT_WRITE) != 0;
+        tlb.m_Dirty = (*level1 & *level2 & BIT_DIRTY) != 0;
+        return (uint32_t *) (m_MemStart + frameAddr + (address & ~ADDR_MASK));
     }
 }
+
+//-------------------------------------------------------------------------------------------------
+void CCPU::tlbFlush(void) {
+    memset(m_Tlb, 0, sizeof(m_Tlb));
+}
+
+//-------------------------------------------------------------------------------------------------
+void CCPU::tlbFlushPage(uint32_t address) {
+    TTlbEntry &tlb = m_Tlb[(address >> OFFSET_BITS) % TLB_ENTRIES];
+    if (tlb.m_Tag == (address >> OFFSET_BITS) + 1)
+        tlb.m_Tag = 0;
+}
 //-------------------------------------------------------------------------------------------------
 
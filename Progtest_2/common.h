@@ -14,10 +14,13 @@ public:
     static const uint32_t BIT_USER = 0x0004;
     static const uint32_t BIT_REFERENCED = 0x0020;
     static const uint32_t BIT_DIRTY = 0x0040;
+    // level 1 only: the entry maps a 4 MiB aligned run of frames itself, there is no level 2 table
+    static const uint32_t BIT_LARGE = 0x0080;
+    static const uint32_t LARGE_ADDR_MASK = ~(PAGE_SIZE * PAGE_DIR_ENTRIES - 1);
 
     CCPU(uint8_t *memStart, uint32_t pageTableRoot);
 
-    virtual ~CCPU(void) {}
+    virtual ~CCPU(void) { pthread_mutex_destroy(&m_TableMutex); }
 
     virtual uint32_t GetMemLimit(void) const = 0;
 
@@ -25,21 +28,168 @@ public:
 
     virtual bool NewProcess(void *processArg, void (*entryPoint)(CCPU *, void *), bool copyMem) = 0;
 
+    // shared segments: frames allocated once and mapped by every process that attaches the segment, a forked
+    // process inherits the attachments of its parent
+    virtual uint32_t ShmCreate(uint32_t pages) = 0; // segment id, 0 if there is not enough memory
+
+    // address is placed as for MemMap
+    virtual bool ShmAttach(uint32_t id, uint32_t address) = 0;
+
+    virtual bool ShmDetach(uint32_t address) = 0;
+
+    // the segment is freed once the last process detaches it, until then it cannot be attached again
+    virtual bool ShmRemove(uint32_t id) = 0;
+
+    // sparse regions of zeroed pages besides the memory limit range, read only unless write is set. address is page
+    // aligned, the region overlaps no other mapping and the 4 MiB areas it touches lie above the memory limit,
+    // SetMemLimit cannot grow into them then
+    virtual bool MemMap(uint32_t address, uint32_t pages, bool write) = 0;
+
+    // unmaps the pages of regions in the range, a region hit partly is trimmed or split, segments only by ShmDetach
+    virtual bool MemUnmap(uint32_t address, uint32_t pages) = 0;
+
+    // maps the host file path from byte offset (page aligned) on as a region placed as for MemMap. Pages are read on
+    // first access, with readahead when accessed sequentially. With write the file is opened for writing too and
+    // changed pages go back to it on MemSync, MemUnmap, process exit and page replacement. Pages past the end of the
+    // file read as zeros and are not written, mappings of one file by several processes are not coherent
+    virtual bool MapFile(uint32_t address, uint32_t pages, const char *path, uint32_t offset, bool write) = 0;
+
+    // writes the changed pages of file mappings in the range back
+    virtual bool MemSync(uint32_t address, uint32_t pages) = 0;
+
     bool ReadInt(uint32_t address, uint32_t &value);
 
     bool WriteInt(uint32_t address, uint32_t value);
 
+    // block transfers translate once per page, they return the number of bytes done before the first failed page
+    uint32_t ReadBlock(uint32_t address, void *data, uint32_t size);
+
+    uint32_t WriteBlock(uint32_t address, const void *data, uint32_t size);
+
+    uint32_t FillBlock(uint32_t address, uint8_t value, uint32_t size);
+
 protected:
+    static const uint32_t TLB_ENTRIES = 64;
+
+    struct TTlbEntry {
+        uint32_t m_Tag;     // virtual page number + 1, 0 marks an empty entry
+        uint32_t *m_Level1; // entries the referenced / dirty bits are written to
+        uint32_t *m_Level2;
+        uint8_t *m_Frame;
+        bool m_Write;       // both levels allow writing
+        bool m_Dirty;       // the dirty bit is already set in both levels
+    };
+
     uint32_t *virtual2Physical(uint32_t address, bool write);
 
     virtual bool pageFaultHandler(uint32_t address, bool write) {
         return false;
     }
 
+    uint32_t blockChunk(uint32_t address, uint32_t size) const;
+
+    void tableLock(void) {
+        if (m_TableShared) {
+            pthread_mutex_lock(&m_TableMutex);
+            m_TableDepth++;
+        }
+    }
+
+    void tableUnlock(void) {
+        if (m_TableShared) {
+            m_TableDepth--;
+            pthread_mutex_unlock(&m_TableMutex);
+        }
+    }
+
+    void tlbFlush(void);
+
+    void tlbFlushPage(uint32_t address);
+
     uint8_t *m_MemStart;
     uint32_t m_PageTableRoot;
+    TTlbEntry m_Tlb[TLB_ENTRIES];
+    // other threads may change the page tables (page replacement), every access then holds the recursive m_TableMutex
+    bool m_TableShared;
+    pthread_mutex_t m_TableMutex;
+    uint32_t m_TableDepth; // how many times the owning thread holds m_TableMutex through tableLock
+};
+
+
+struct TMemMgrConfig {
+    bool m_LazyAlloc = false; // SetMemLimit only reserves the frames, a frame is mapped on the first access
+    uint32_t m_ZeroLow = 64;   // the background thread refills the pool of zeroed frames when it drops below this
+    uint32_t m_ZeroHigh = 0;   // size the pool is refilled to, 0 (the default) disables the thread
+    uint32_t m_SwapPages = 0;  // pages of swap, committed memory may exceed the physical memory by this much
+    const char *m_SwapFile = "memmgr.swap"; // created by MemMgr and unlinked right away
+    uint32_t m_ZramPages = 0;  // pages that may be kept compressed in the managed memory in front of the swap, needs m_SwapPages
+    uint32_t m_LargePages = 0; // 4 MiB runs set aside for large page mappings of whole 1024 page regions, more are taken when free
+    bool m_Compaction = false; // move pages to build free 4 MiB blocks, page tables are then always locked
+    uint32_t m_MergeScan = 0;  // frames the same-page merging thread checks per pass, 0 disables it, page tables are then always locked
+    uint32_t m_MergeSleep = 20; // ms between the passes
+    // threads running the processes, started on demand and reused, 0 = a thread for every process that finds none idle.
+    // With a limit further processes wait until one finishes, so processes that wait for each other need as many
+    // threads as run at once
+    uint32_t m_ProcessThreads = 0;
+    uint32_t m_StatsDump = 0;  // ms between dumps of MemMgrStats to stderr by a background thread, 0 disables it
+};
+
+void MemMgrConfig(const TMemMgrConfig &config);
+
+struct TMemFragStats {
+    uint32_t m_FreeFrames;      // in the global pool, frames cached per CPU are not counted
+    uint32_t m_FreeBlocks[11];  // free blocks of 1 << order frames, order 10 is a large page
+    uint32_t m_LargestBlock;    // frames in the largest free block
+    uint32_t m_Unusable;        // per mille of the free frames that are not in 4 MiB blocks
+};
+
+// both may be called by the simulated processes while MemMgr runs
+void MemMgrFragStats(TMemFragStats &stats);
+
+// builds one free 4 MiB block by moving pages (needs m_Compaction), false if no block could be built
+bool MemMgrCompact(void);
+
+// same-page merging maps pages of equal content to one read-only frame, a write gives the page its own copy again
+struct TMemMergeStats {
+    uint32_t m_Scanned;  // frames checked so far
+    uint32_t m_Merged;   // pages merged so far, each gave its frame back
+    uint32_t m_Shared;   // merged frames mapped more than once now
+    uint32_t m_Saved;    // pages mapping them beyond the first, frames saved now
+};
+
+void MemMgrMergeStats(TMemMergeStats &stats);
+
+struct TMemProcStats {
+    uint32_t m_Pid;          // processes are numbered from 1 (init) in the order they were created, 0 in m_Total
+    uint32_t m_Limit;        // GetMemLimit
+    uint32_t m_Mapped;       // pages of the memory limit range and of all regions
+    uint32_t m_Resident;     // of these with a frame mapped now
+    uint32_t m_Reserved;     // lazy pages, their frame is claimed but not mapped yet
+    uint32_t m_Swapped;      // pages in the swap file
+    uint32_t m_Compressed;   // pages in zram
+    uint32_t m_Tables;       // level 2 page tables
+    // events since the process started, in m_Total since MemMgr started
+    uint64_t m_LazyFaults;   // first accesses to lazy pages
+    uint64_t m_FileFaults;   // first accesses to pages of mapped files, each reads the page with its readahead
+    uint64_t m_SwapFaults;
+    uint64_t m_ZramFaults;
+    uint64_t m_CowFaults;    // writes to copy-on-write pages, with or without a copy
+    uint64_t m_FramesAllocated;
+    uint64_t m_FramesFreed;
+    uint64_t m_ForkBytes;    // page tables written for child processes
+};
+
+struct TMemStats {
+    uint32_t m_Processes;    // running now
+    uint32_t m_Created;      // since MemMgr started
+    uint32_t m_FreeFrames;   // not claimed by anyone, with swap this includes the overcommit
+    uint64_t m_PoolWaits;    // acquisitions of the frame pool lock that had to wait
+    uint64_t m_PoolWaitNs;   // and the time they waited
+    TMemProcStats m_Total;   // sums over the running processes, the events include finished ones
 };
 
+// snapshot of the counters, procs gets up to max running processes, returns the number of running processes
+uint32_t MemMgrStats(TMemStats &stats, TMemProcStats *procs, uint32_t max);
 
 void MemMgr(void *mem, uint32_t totalPages, void *processArg, void (*mainProcess)(CCPU *, void *));
 
@@ -10,84 +10,1624 @@
 #include <cstring>
 #include <pthread.h>
 #include <semaphore.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "common.h"
 
 using namespace std;
 #endif /* __PROGTEST__ */
 // #define DEBUG_PRINT // uncomment to enable debug prints
-////----------------------------------------------------------------------------------------------------------CPageStack
-static class CPageStack{
+static TMemMgrConfig g_Config;
+static const uint32_t NO_FRAME = 0xffffffff;
+/**
+ * Counter written by one thread at a time (its owner, or whoever holds the owner's locks) and read by MemMgrStats from
+ * any thread. Relaxed atomic loads and stores keep those reads defined without a locked instruction on the write path.
+ */
+template <typename T>
+class CCounter{
+private:
+    T m_value;
+public:
+    CCounter(T value = 0): m_value(value){}
+    CCounter & operator = (const CCounter & other){ return *this = (T) other; }
+    CCounter & operator = (T value){ __atomic_store_n(&m_value, value, __ATOMIC_RELAXED); return *this; }
+    operator T () const { return __atomic_load_n(&m_value, __ATOMIC_RELAXED); }
+    CCounter & operator += (T n){ return *this = (T) *this + n; }
+    CCounter & operator -= (T n){ return *this = (T) *this - n; }
+    CCounter & operator ++ (){ return *this += 1; }
+    CCounter & operator -- (){ return *this -= 1; }
+    T operator ++ (int){ T old = *this; *this = old + 1; return old; }
+    T operator -- (int){ T old = *this; *this = old - 1; return old; }
+};
+////----------------------------------------------------------------------------------------------------------CFramePool
+/**
+ * Global pool of free frames, a buddy allocator. A free block of 2^order frames is aligned to its size and sits in the
+ * free list of its order, a freed block merges with its buddy for as long as the buddy is free as well. CFrameCache
+ * refills with one block of BATCH frames when there is one, so the frames of a process lie together, and large pages
+ * take whole blocks of MAX_ORDER.
+ * The lists are threaded through arrays indexed by frame under one mutex, the per CPU caches keep it off the fast path.
+ * Accounting is separate from the frames themselves: m_available counts the free frames nobody has claimed yet,
+ * wherever they currently are (here or in a CFrameCache), lazy pages claim their frame in advance. With swap the
+ * claims may exceed the physical memory, frames that page replacement cannot take back are counted in m_pinned too.
+ * Frames zeroed in advance by a background thread wait outside the buddy lists on a zeroed list, which is kept
+ * between two watermarks and given back to the buddy lists when a large block is needed.
+ */
+static class CFramePool{
+public:
+    static const uint32_t MAX_ORDER = 10;  // 4 MiB, one large page
+    static const uint32_t BATCH_ORDER = 5;
+    static const uint32_t BATCH = 1 << BATCH_ORDER; // frames moved between the pool and a cache at once
+private:
+    static const uint32_t ZERO_LIST = MAX_ORDER + 1;
+    static const uint8_t NOT_FREE = 0xff; // m_order of a frame that does not start a free block
+    static const uint8_t ZEROED = 0xfe;   // m_order of a frame on the zeroed list
+    static const uint8_t ISOLATED = 0xfd; // m_order of a free frame held by compaction
+    uint8_t * m_memStart;
+    uint32_t m_totalPages;
+    uint32_t * m_next = nullptr; // list links, NO_FRAME ends a list
+    uint32_t * m_prev = nullptr;
+    uint8_t * m_order = nullptr;
+    uint32_t m_head[ZERO_LIST + 1];
+    uint32_t m_count[ZERO_LIST + 1];
+    uint32_t m_available;   // free frames not claimed by anyone
+    uint32_t m_pinned;      // claimed frames page replacement cannot take back (shared memory segments)
+    uint32_t m_returned;    // frames ever put back to the lists, read without the mutex
+    uint32_t m_zeroed;      // frames on the zeroed list, read by the zeroing thread without the mutex
+    uint32_t m_zeroLow;     // the zeroing thread wakes up below this many zeroed frames
+    uint32_t m_zeroHigh;    // and refills up to this many
+    bool m_zeroRun = false;
+    bool m_zeroDry = false; // the zeroing thread found nothing free and waits for pushBatch, set under m_mutex
+    pthread_t m_zeroThread;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t m_zeroMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t m_zeroCond = PTHREAD_COND_INITIALIZER;
+    uint64_t m_waits = 0;   // acquisitions of m_mutex that found it busy, guarded by it
+    uint64_t m_waitNs = 0;  // and the time spent waiting
+    static void * zeroMain(void * pool);
+    /** Locks m_mutex, a wait is timed for MemMgrStats. */
+    void lock(){
+        if (pthread_mutex_trylock(&m_mutex) == 0)
+            return;
+        timespec from, to;
+        clock_gettime(CLOCK_MONOTONIC, &from);
+        pthread_mutex_lock(&m_mutex);
+        clock_gettime(CLOCK_MONOTONIC, &to);
+        m_waits++;
+        m_waitNs += (uint64_t) (to.tv_sec - from.tv_sec) * 1000000000u + to.tv_nsec - from.tv_nsec;
+    }
+    /** Caller holds m_mutex. */
+    void link(uint32_t list, uint32_t frame, uint8_t order){
+        m_order[frame] = order;
+        m_prev[frame] = NO_FRAME;
+        m_next[frame] = m_head[list];
+        if (m_head[list] != NO_FRAME) m_prev[m_head[list]] = frame;
+        m_head[list] = frame;
+        m_count[list]++;
+    }
+    /** Caller holds m_mutex. */
+    void unlink(uint32_t list, uint32_t frame){
+        if (m_prev[frame] != NO_FRAME) m_next[m_prev[frame]] = m_next[frame];
+        else m_head[list] = m_next[frame];
+        if (m_next[frame] != NO_FRAME) m_prev[m_next[frame]] = m_prev[frame];
+        m_order[frame] = NOT_FREE;
+        m_count[list]--;
+    }
+    /** Caller holds m_mutex. @return first frame of a block of 2^order frames or NO_FRAME */
+    uint32_t allocLocked(uint32_t order){
+        uint32_t o = order;
+        while (o <= MAX_ORDER && m_head[o] == NO_FRAME) o++;
+        if (o > MAX_ORDER) return NO_FRAME;
+        uint32_t block = m_head[o];
+        unlink(o, block);
+        // the upper halves stay free
+        while (o > order){
+            o--;
+            link(o, block + (1 << o), o);
+        }
+        return block;
+    }
+    /** Caller holds m_mutex. */
+    void freeLocked(uint32_t block, uint32_t order){
+        while (order < MAX_ORDER){
+            uint32_t buddy = block ^ (1 << order);
+            if (buddy >= m_totalPages || m_order[buddy] != order) break;
+            unlink(order, buddy);
+            block &= ~(1 << order);
+            order++;
+        }
+        link(order, block, order);
+    }
+    /** Caller holds m_mutex. */
+    void unzeroLocked(){
+        while (m_head[ZERO_LIST] != NO_FRAME){
+            uint32_t frame = m_head[ZERO_LIST];
+            unlink(ZERO_LIST, frame);
+            freeLocked(frame, 0);
+        }
+        __atomic_store_n(&m_zeroed, 0, __ATOMIC_RELEASE);
+    }
+    /** Caller holds m_mutex and has just put free frames back. @return the zeroing thread has to be woken up */
+    bool undryLocked(){
+        bool dry = m_zeroDry;
+        __atomic_store_n(&m_zeroDry, false, __ATOMIC_RELEASE);
+        return dry;
+    }
+    void wakeZeroing(){
+        pthread_mutex_lock(&m_zeroMutex);
+        pthread_cond_signal(&m_zeroCond);
+        pthread_mutex_unlock(&m_zeroMutex);
+    }
+    /**
+     * The zeroing thread found nothing to zero, unless frames came back since. The check and the flag share m_mutex
+     * with pushBatch, so a batch pushed in between is never missed.
+     * @return true if the thread may sleep until undryLocked clears the flag
+     */
+    bool markDry(){
+        bool dry = true;
+        lock();
+        for (uint32_t o = 0; o <= MAX_ORDER && dry; o++)
+            dry = m_head[o] == NO_FRAME;
+        if (dry) __atomic_store_n(&m_zeroDry, true, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&m_mutex);
+        return dry;
+    }
+public:
+    void init(uint8_t * memStart, uint32_t totalPages){
+        m_memStart = memStart;
+        m_totalPages = totalPages;
+        m_next = new uint32_t [totalPages];
+        m_prev = new uint32_t [totalPages];
+        m_order = new uint8_t [totalPages];
+        memset(m_order, NOT_FREE, totalPages);
+        for (uint32_t i = 0; i <= ZERO_LIST; i++){
+            m_head[i] = NO_FRAME;
+            m_count[i] = 0;
+        }
+        m_available = totalPages;
+        m_pinned = 0;
+        m_returned = 0;
+        m_zeroed = 0;
+        m_waits = m_waitNs = 0;
+        // the largest aligned blocks that fit, low frames end up on top of their lists
+        for (uint32_t frame = totalPages; frame > 0; ){
+            uint32_t order = 0;
+            while (order < MAX_ORDER && frame % (2u << order) == 0 && (2u << order) <= frame) order++;
+            frame -= 1 << order;
+            link(order, frame, order);
+        }
+    }
+    void done(){
+        delete[] m_next; delete[] m_prev; delete[] m_order;
+        m_next = m_prev = nullptr;
+        m_order = nullptr;
+        m_available = 0;
+        m_pinned = 0;
+        m_zeroed = 0;
+    }
+    uint32_t available(){ return __atomic_load_n(&m_available, __ATOMIC_ACQUIRE); }
+    void clear(uint32_t frame){ memset(m_memStart + (frame << CCPU::OFFSET_BITS), 0, CCPU::PAGE_SIZE); }
+    /** Claims n free frames (or reservations for lazy pages), all or nothing. */
+    bool take(uint32_t n){
+        uint32_t cur = available();
+        do {
+            if (cur < n) return false;
+        } while (!__atomic_compare_exchange_n(&m_available, &cur, cur - n, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        return true;
+    }
+    /** Returns n claims, the frames themselves have already been put back to a cache. */
+    void give(uint32_t n){ __atomic_add_fetch(&m_available, n, __ATOMIC_ACQ_REL); }
+    /** Claims n frames that stay pinned, they have to fit into the physical memory, swap cannot stand in for them. */
+    bool takePinned(uint32_t n){
+        uint32_t cur = __atomic_load_n(&m_pinned, __ATOMIC_ACQUIRE);
+        do {
+            if (n > m_totalPages - cur) return false;
+        } while (!__atomic_compare_exchange_n(&m_pinned, &cur, cur + n, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        if (take(n)) return true;
+        __atomic_sub_fetch(&m_pinned, n, __ATOMIC_ACQ_REL);
+        return false;
+    }
+    void givePinned(uint32_t n){
+        give(n);
+        __atomic_sub_fetch(&m_pinned, n, __ATOMIC_ACQ_REL);
+    }
+    void pushBatch(const uint32_t * frames, uint32_t count, bool zeroed = false){
+        lock();
+        for (uint32_t i = 0; i < count; i++)
+            if (zeroed) link(ZERO_LIST, frames[i], ZEROED);
+            else freeLocked(frames[i], 0);
+        __atomic_add_fetch(&m_returned, count, __ATOMIC_RELEASE);
+        bool wake = !zeroed && undryLocked();
+        pthread_mutex_unlock(&m_mutex);
+        if (zeroed) __atomic_add_fetch(&m_zeroed, count, __ATOMIC_ACQ_REL);
+        if (wake) wakeZeroing();
+    }
+    /**
+     * One block of BATCH frames if there is one, otherwise whatever single frames are left.
+     * @return number of frames written to frames (at most BATCH), 0 if the pool is empty
+     */
+    uint32_t popBatch(uint32_t * frames, bool zeroed = false){
+        uint32_t count = 0, block;
+        lock();
+        if (zeroed)
+            while (count < BATCH && (block = m_head[ZERO_LIST]) != NO_FRAME){
+                unlink(ZERO_LIST, block);
+                frames[count++] = block;
+            }
+        else if ((block = allocLocked(BATCH_ORDER)) != NO_FRAME)
+            for (; count < BATCH; count++)
+                frames[count] = block + count;
+        else
+            while (count < BATCH && (block = allocLocked(0)) != NO_FRAME)
+                frames[count++] = block;
+        pthread_mutex_unlock(&m_mutex);
+        if (zeroed && count > 0 && __atomic_sub_fetch(&m_zeroed, count, __ATOMIC_ACQ_REL) < m_zeroLow && m_zeroRun)
+            wakeZeroing();
+        return count;
+    }
+    /** Block of 2^order frames for the caller's claim, zeroed frames go back to the buddy lists if needed. */
+    uint32_t allocBlock(uint32_t order){
+        lock();
+        uint32_t block = allocLocked(order);
+        if (block == NO_FRAME && m_head[ZERO_LIST] != NO_FRAME){
+            unzeroLocked();
+            block = allocLocked(order);
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return block;
+    }
+    void freeBlock(uint32_t block, uint32_t order){
+        lock();
+        freeLocked(block, order);
+        __atomic_add_fetch(&m_returned, 1u << order, __ATOMIC_RELEASE);
+        bool wake = undryLocked();
+        pthread_mutex_unlock(&m_mutex);
+        if (wake) wakeZeroing();
+    }
+    /** @return frames put back so far, a change means that some claimed frame may have become free */
+    uint32_t returned(){ return __atomic_load_n(&m_returned, __ATOMIC_ACQUIRE); }
+    void lockStats(uint64_t & waits, uint64_t & ns){
+        lock();
+        waits = m_waits;
+        ns = m_waitNs;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    void stats(TMemFragStats & stats){
+        memset(&stats, 0, sizeof(stats));
+        lock();
+        stats.m_FreeFrames = m_count[ZERO_LIST];
+        for (uint32_t order = 0; order <= MAX_ORDER; order++){
+            stats.m_FreeBlocks[order] = m_count[order];
+            stats.m_FreeFrames += m_count[order] << order;
+            if (m_count[order] > 0) stats.m_LargestBlock = 1 << order;
+        }
+        if (stats.m_FreeFrames > 0)
+            stats.m_Unusable = (uint32_t) ((uint64_t) (stats.m_FreeFrames - (m_count[MAX_ORDER] << MAX_ORDER)) * 1000
+                                           / stats.m_FreeFrames);
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /**
+     * Marks every free frame (buddy lists and zeroed list) in free, for compaction to choose a block.
+     * @return number of free frames
+     */
+    uint32_t freeMap(uint8_t * free){
+        uint32_t total = 0;
+        memset(free, 0, m_totalPages);
+        lock();
+        for (uint32_t order = 0; order <= ZERO_LIST; order++)
+            for (uint32_t frame = m_head[order]; frame != NO_FRAME; frame = m_next[frame]){
+                uint32_t size = order == ZERO_LIST ? 1 : 1 << order;
+                memset(free + frame, 1, size);
+                total += size;
+            }
+        pthread_mutex_unlock(&m_mutex);
+        return total;
+    }
+    /** Takes the free frames of the MAX_ORDER block at first out of the lists, compaction then fills it up. */
+    void isolate(uint32_t first){
+        lock();
+        for (uint32_t frame = first; frame < first + (1 << MAX_ORDER); ){
+            uint8_t order = m_order[frame];
+            if (order == ZEROED){
+                unlink(ZERO_LIST, frame);
+                __atomic_sub_fetch(&m_zeroed, 1, __ATOMIC_ACQ_REL);
+                order = 0;
+            } else if (order <= MAX_ORDER)
+                unlink(order, frame);
+            else {
+                frame++;
+                continue;
+            }
+            memset(m_order + frame, ISOLATED, 1 << order);
+            frame += 1 << order;
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+    bool isolated(uint32_t frame){
+        lock();
+        bool res = m_order[frame] == ISOLATED;
+        pthread_mutex_unlock(&m_mutex);
+        return res;
+    }
+    /** A frame moved away by compaction joins the isolated ones. */
+    void addIsolated(uint32_t frame){
+        lock();
+        m_order[frame] = ISOLATED;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /**
+     * Ends compaction of the block at first.
+     * @param keep the block is complete and goes to the caller, otherwise its isolated frames go back to the lists
+     */
+    void release(uint32_t first, bool keep){
+        lock();
+        for (uint32_t frame = first; frame < first + (1 << MAX_ORDER); frame++)
+            if (m_order[frame] == ISOLATED){
+                m_order[frame] = NOT_FREE;
+                if (!keep) freeLocked(frame, 0);
+            }
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /** Starts the zeroing thread, high = 0 leaves it off and every zeroed frame is cleared on demand. */
+    void startZeroing(uint32_t low, uint32_t high){
+        m_zeroLow = low;
+        m_zeroHigh = high;
+        m_zeroDry = false;
+        if (high == 0) return;
+        m_zeroRun = true;
+        pthread_create(&m_zeroThread, nullptr, zeroMain, this);
+    }
+    void stopZeroing(){
+        if (!m_zeroRun) return;
+        __atomic_store_n(&m_zeroRun, false, __ATOMIC_RELEASE);
+        wakeZeroing();
+        pthread_join(m_zeroThread, nullptr);
+    }
+} framePool;
+
+/**
+ * Background zeroing: moves free batches to the zeroed list until it holds m_zeroHigh frames, then sleeps until
+ * allocations take it below m_zeroLow. When there is nothing free to zero it sleeps until pushBatch or freeBlock
+ * gives frames back.
+ */
+void * CFramePool::zeroMain(void * pool){
+    auto * self = (CFramePool *) pool;
+    uint32_t frames[BATCH];
+    pthread_mutex_lock(&self->m_zeroMutex);
+    while (self->m_zeroRun){
+        pthread_mutex_unlock(&self->m_zeroMutex);
+        bool dry = false;
+        while (__atomic_load_n(&self->m_zeroRun, __ATOMIC_ACQUIRE)
+               && __atomic_load_n(&self->m_zeroed, __ATOMIC_ACQUIRE) < self->m_zeroHigh){
+            uint32_t count = self->popBatch(frames);
+            if (count == 0){
+                if ((dry = self->markDry()))
+                    break;
+                continue;
+            }
+            for (uint32_t i = 0; i < count; i++)
+                self->clear(frames[i]);
+            self->pushBatch(frames, count, true);
+        }
+        pthread_mutex_lock(&self->m_zeroMutex);
+        if (dry){
+            while (self->m_zeroRun && __atomic_load_n(&self->m_zeroDry, __ATOMIC_ACQUIRE))
+                pthread_cond_wait(&self->m_zeroCond, &self->m_zeroMutex);
+            continue;
+        }
+        while (self->m_zeroRun && __atomic_load_n(&self->m_zeroed, __ATOMIC_ACQUIRE) >= self->m_zeroLow)
+            pthread_cond_wait(&self->m_zeroCond, &self->m_zeroMutex);
+    }
+    pthread_mutex_unlock(&self->m_zeroMutex);
+    return nullptr;
+}
+/** Builds a free block of MAX_ORDER by moving pages away, defined with CMyCPU. */
+static uint32_t compactRun();
+////----------------------------------------------------------------------------------------------------------CLargePool
+/**
+ * Runs of PAGE_DIR_ENTRIES frames for large page mappings, blocks of MAX_ORDER from framePool.
+ * The first m_LargePages runs are reserved at start together with their claims, a reserved run freed whole comes back
+ * here. Past the reserve a run is claimed and taken from framePool on demand, with m_Compaction a missing block is
+ * built by compaction. A run that a process has to split (fork, shrinking into the region) becomes ordinary frames
+ * of the process, they go back to framePool one by one and merge there again.
+ */
+static class CLargePool{
+private:
+    uint32_t * m_free = nullptr; // stack of free reserved runs
+    uint32_t m_top = 0;
+    bool * m_reserved = nullptr; // per run: the run belongs to the reserve
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+public:
+    static const uint32_t RUN = CCPU::PAGE_DIR_ENTRIES;
+    bool enabled(){ return m_reserved != nullptr; }
+    void init(uint32_t totalPages, uint32_t wanted){
+        if (wanted == 0) return;
+        m_free = new uint32_t [wanted];
+        m_reserved = new bool [totalPages / RUN + 1];
+        memset(m_reserved, 0, totalPages / RUN + 1);
+        for (m_top = 0; m_top < wanted && framePool.take(RUN); m_top++){
+            uint32_t run = framePool.allocBlock(CFramePool::MAX_ORDER);
+            if (run == NO_FRAME){
+                framePool.give(RUN);
+                break;
+            }
+            m_free[m_top] = run;
+            m_reserved[run / RUN] = true;
+        }
+    }
+    /** Reserved runs still here go back to framePool with their claims. */
+    void done(){
+        for (uint32_t i = 0; i < m_top; i++){
+            framePool.freeBlock(m_free[i], CFramePool::MAX_ORDER);
+            framePool.give(RUN);
+        }
+        delete[] m_free;
+        delete[] m_reserved;
+        m_free = nullptr;
+        m_reserved = nullptr;
+        m_top = 0;
+    }
+    /** @return first frame of a run claimed for the caller or NO_FRAME */
+    uint32_t alloc(){
+        pthread_mutex_lock(&m_mutex);
+        uint32_t run = m_top ? m_free[--m_top] : NO_FRAME;
+        pthread_mutex_unlock(&m_mutex);
+        if (run != NO_FRAME || !framePool.take(RUN))
+            return run;
+        run = framePool.allocBlock(CFramePool::MAX_ORDER);
+        if (run == NO_FRAME && g_Config.m_Compaction)
+            run = compactRun();
+        if (run == NO_FRAME)
+            framePool.give(RUN);
+        return run;
+    }
+    void free(uint32_t run){
+        if (!m_reserved[run / RUN]){
+            framePool.freeBlock(run, CFramePool::MAX_ORDER);
+            framePool.give(RUN);
+            return;
+        }
+        pthread_mutex_lock(&m_mutex);
+        m_free[m_top++] = run;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /** The run is split into ordinary frames, its claims stay with them. */
+    void split(uint32_t run){ m_reserved[run / RUN] = false; }
+} largePool;
+////---------------------------------------------------------------------------------------------------------------CSwap
+/**
+ * Swap file divided into page sized slots. The file is unlinked as soon as it is opened, so it disappears with the
+ * descriptor. Slots are handed out from a stack under a mutex, swapping is the slow path anyway.
+ * A slot is shared by all page table entries of a page evicted while shared and by forked copies of the entry.
+ */
+static class CSwap{
+private:
+    int m_fd = -1;     // -1 = swapping is off
+    uint32_t * m_free = nullptr; // stack of free slots
+    uint32_t * m_refs = nullptr; // page table entries referring to each slot
+    uint32_t m_top = 0;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+public:
+    bool init(const char * path, uint32_t pages){
+        m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (m_fd < 0) return false;
+        unlink(path);
+        m_free = new uint32_t [pages];
+        m_refs = new uint32_t [pages];
+        for (m_top = 0; m_top < pages; m_top++)
+            m_free[m_top] = pages - 1 - m_top;
+        return true;
+    }
+    bool enabled(){ return m_fd >= 0; }
+    void done(){
+        if (m_fd >= 0) close(m_fd);
+        delete[] m_free;
+        delete[] m_refs;
+        m_fd = -1;
+        m_free = m_refs = nullptr;
+        m_top = 0;
+    }
+    /** @return free slot with one reference or NO_FRAME */
+    uint32_t alloc(){
+        pthread_mutex_lock(&m_mutex);
+        uint32_t slot = m_top ? m_free[--m_top] : NO_FRAME;
+        if (slot != NO_FRAME) m_refs[slot] = 1;
+        pthread_mutex_unlock(&m_mutex);
+        return slot;
+    }
+    void get(uint32_t slot){
+        pthread_mutex_lock(&m_mutex);
+        m_refs[slot]++;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    void free(uint32_t slot){
+        pthread_mutex_lock(&m_mutex);
+        if (--m_refs[slot] == 0) m_free[m_top++] = slot;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    bool write(uint32_t slot, const void * page){
+        return pwrite(m_fd, page, CCPU::PAGE_SIZE, (off_t) slot * CCPU::PAGE_SIZE) == (ssize_t) CCPU::PAGE_SIZE;
+    }
+    bool read(uint32_t slot, void * page){
+        return pread(m_fd, page, CCPU::PAGE_SIZE, (off_t) slot * CCPU::PAGE_SIZE) == (ssize_t) CCPU::PAGE_SIZE;
+    }
+} swapFile;
+////---------------------------------------------------------------------------------------------------------------CZram
+/**
+ * Compressed page store in front of the swap file, kept in frames of the managed memory.
+ * A store frame is split into 64 byte chunks, a compressed page takes a run of chunks in one store frame and is found
+ * through a slot, the slot number goes to the page table entry. When no store frame has room, the frame of the page
+ * being compressed becomes a new store frame. A store frame whose chunks are all free goes back to the caller.
+ * Compression works on words: 2 bit tag per word (zero, or the difference from the last non zero word in 1, 2 or 4
+ * bytes), so the sparse counters simulated processes write shrink several times.
+ * It adds no committed memory, a compressed page keeps the claim it had as a resident page. zram therefore runs only
+ * with the swap file behind it, which takes the pages that do not compress or fit. Store frames cannot be evicted,
+ * they take at most half of the memory so that page replacement always finds pages to move to swap.
+ */
+static class CZram{
+private:
+    static const uint32_t CHUNK = 64;
+    static const uint32_t CHUNKS = CCPU::PAGE_SIZE / CHUNK;
+    static const uint32_t WORDS = CCPU::PAGE_SIZE / 4;
+    static const uint32_t TAGS = WORDS / 4;            // bytes of tags at the start of a compressed page
+    static const uint32_t MAX_SIZE = CCPU::PAGE_SIZE / 2; // pages that do not compress to this go to the swap file
+    struct TSlot{
+        uint32_t m_frame;
+        uint16_t m_chunk;
+        uint16_t m_size;
+        uint32_t m_refs; // page table entries referring to the slot, shared like swap slots
+    };
+    uint8_t * m_memStart;
+    uint64_t * m_used = nullptr;  // chunk bitmap of every frame, used only for store frames
+    uint32_t * m_store = nullptr; // store frames
+    uint32_t m_storeCount = 0;
+    uint32_t m_storeMax = 0;      // store frames may take at most half of the memory, the rest stays evictable
+    TSlot * m_slots = nullptr;
+    uint32_t * m_free = nullptr;  // stack of free slots
+    uint32_t m_top = 0;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static uint32_t compress(const uint32_t * src, uint8_t * dst){
+        uint32_t pos = TAGS, prev = 0;
+        memset(dst, 0, TAGS);
+        for (uint32_t i = 0; i < WORDS; i++){
+            if (src[i] == 0) continue;
+            auto diff = (int32_t) (src[i] - prev);
+            uint32_t tag = diff >= -128 && diff <= 127 ? 1 : diff >= -32768 && diff <= 32767 ? 2 : 3;
+            uint32_t len = tag == 3 ? 4 : tag;
+            if (pos + len > MAX_SIZE) return 0;
+            memcpy(dst + pos, tag == 3 ? (const void *) &src[i] : (const void *) &diff, len); // little endian
+            pos += len;
+            dst[i / 4] |= tag << (2 * (i % 4));
+            prev = src[i];
+        }
+        return pos;
+    }
+    static void decompress(const uint8_t * src, uint32_t * dst){
+        uint32_t pos = TAGS, prev = 0;
+        for (uint32_t i = 0; i < WORDS; i++){
+            uint32_t tag = (src[i / 4] >> (2 * (i % 4))) & 3;
+            if (tag == 0){
+                dst[i] = 0;
+                continue;
+            }
+            if (tag == 3){
+                memcpy(&dst[i], src + pos, 4);
+                pos += 4;
+            } else {
+                int32_t diff = tag == 1 ? (int32_t) (int8_t) src[pos] : (int32_t) (int16_t) (src[pos] | src[pos + 1] << 8);
+                dst[i] = prev + (uint32_t) diff;
+                pos += tag;
+            }
+            prev = dst[i];
+        }
+    }
+    /** Caller holds m_mutex. @return first chunk of a free run of count chunks in frame, CHUNKS if there is none */
+    uint32_t findRun(uint32_t frame, uint32_t count){
+        uint64_t mask = count == 64 ? ~0ULL : ((1ULL << count) - 1);
+        for (uint32_t c = 0; c + count <= CHUNKS; c++)
+            if ((m_used[frame] & (mask << c)) == 0) return c;
+        return CHUNKS;
+    }
+public:
+    bool enabled(){ return m_slots != nullptr; }
+    void init(uint8_t * memStart, uint32_t totalPages, uint32_t pages){
+        m_memStart = memStart;
+        m_used = new uint64_t [totalPages];
+        m_store = new uint32_t [totalPages];
+        m_storeCount = 0;
+        m_storeMax = totalPages / 2;
+        m_slots = new TSlot [pages];
+        m_free = new uint32_t [pages];
+        for (m_top = 0; m_top < pages; m_top++)
+            m_free[m_top] = pages - 1 - m_top;
+    }
+    void done(){
+        delete[] m_used; delete[] m_store; delete[] m_slots; delete[] m_free;
+        m_used = nullptr;
+        m_store = m_free = nullptr;
+        m_slots = nullptr;
+        m_top = m_storeCount = 0;
+    }
+    /**
+     * Stores a compressed copy of the page kept in frame.
+     * @param refs references the slot starts with
+     * @param consumed set when frame itself became a store frame and must not be freed
+     * @return slot or NO_FRAME when the page does not compress well or there is no free slot or store frame
+     */
+    uint32_t store(uint32_t frame, uint32_t refs, bool & consumed){
+        uint8_t buf[MAX_SIZE];
+        uint32_t size = compress((const uint32_t *) (m_memStart + (frame << CCPU::OFFSET_BITS)), buf);
+        if (size == 0) return NO_FRAME;
+        uint32_t count = (size + CHUNK - 1) / CHUNK, target = NO_FRAME, chunk = CHUNKS;
+        pthread_mutex_lock(&m_mutex);
+        if (m_top == 0){
+            pthread_mutex_unlock(&m_mutex);
+            return NO_FRAME;
+        }
+        uint32_t slot = m_free[--m_top];
+        for (uint32_t i = 0; i < m_storeCount && chunk == CHUNKS; i++)
+            if ((chunk = findRun(m_store[i], count)) != CHUNKS) target = m_store[i];
+        if (target == NO_FRAME && m_storeCount == m_storeMax){
+            m_free[m_top++] = slot;
+            pthread_mutex_unlock(&m_mutex);
+            return NO_FRAME;
+        }
+        if (target == NO_FRAME){
+            target = frame;
+            chunk = 0;
+            m_used[frame] = 0;
+            m_store[m_storeCount++] = frame;
+            consumed = true;
+        }
+        m_used[target] |= (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << chunk;
+        memcpy(m_memStart + (target << CCPU::OFFSET_BITS) + chunk * CHUNK, buf, size);
+        m_slots[slot].m_frame = target;
+        m_slots[slot].m_chunk = chunk;
+        m_slots[slot].m_size = size;
+        m_slots[slot].m_refs = refs;
+        pthread_mutex_unlock(&m_mutex);
+        return slot;
+    }
+    void load(uint32_t slot, void * page){
+        pthread_mutex_lock(&m_mutex);
+        decompress(m_memStart + (m_slots[slot].m_frame << CCPU::OFFSET_BITS) + m_slots[slot].m_chunk * CHUNK,
+                   (uint32_t *) page);
+        pthread_mutex_unlock(&m_mutex);
+    }
+    void get(uint32_t slot){
+        pthread_mutex_lock(&m_mutex);
+        m_slots[slot].m_refs++;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /** Drops one reference. @return store frame that became empty and is free now, or NO_FRAME */
+    uint32_t free(uint32_t slot){
+        uint32_t emptied = NO_FRAME;
+        pthread_mutex_lock(&m_mutex);
+        TSlot & s = m_slots[slot];
+        if (--s.m_refs > 0){
+            pthread_mutex_unlock(&m_mutex);
+            return NO_FRAME;
+        }
+        uint32_t count = (s.m_size + CHUNK - 1) / CHUNK;
+        m_used[s.m_frame] &= ~((count == 64 ? ~0ULL : ((1ULL << count) - 1)) << s.m_chunk);
+        if (m_used[s.m_frame] == 0){
+            emptied = s.m_frame;
+            for (uint32_t i = 0; i < m_storeCount; i++)
+                if (m_store[i] == emptied){
+                    m_store[i] = m_store[--m_storeCount];
+                    break;
+                }
+        }
+        m_free[m_top++] = slot;
+        pthread_mutex_unlock(&m_mutex);
+        return emptied;
+    }
+} zram;
+////------------------------------------------------------------------------------------------------------------CShmTable
+/**
+ * Shared memory segments. A segment owns its frames from ShmCreate until it has been removed and the last process
+ * detached it. Processes map the frames directly and the frames carry no references in frameTable, so page
+ * replacement, compaction and copy-on-write never touch them.
+ */
+static class CShmTable{
+private:
+    static const uint32_t SEGMENTS = 64;
+    struct TSegment{
+        uint32_t * m_frames = nullptr; // nullptr = free slot
+        uint32_t m_pages = 0;
+        uint32_t m_attached = 0;
+        bool m_removed = false;
+    } m_segments[SEGMENTS];
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+    /** Caller holds m_mutex. @return frames of a segment nobody uses any more, the slot is free again */
+    uint32_t * releaseLocked(TSegment & s, uint32_t & pages){
+        if (!s.m_removed || s.m_attached > 0)
+            return nullptr;
+        uint32_t * frames = s.m_frames;
+        pages = s.m_pages;
+        s = TSegment();
+        return frames;
+    }
+public:
+    /** @return id of a new segment over frames (taken over) or 0 when all slots are used */
+    uint32_t add(uint32_t * frames, uint32_t pages){
+        uint32_t id = 0;
+        pthread_mutex_lock(&m_mutex);
+        for (uint32_t i = 0; i < SEGMENTS && id == 0; i++)
+            if (!m_segments[i].m_frames){
+                m_segments[i].m_frames = frames;
+                m_segments[i].m_pages = pages;
+                id = i + 1;
+            }
+        pthread_mutex_unlock(&m_mutex);
+        return id;
+    }
+    /**
+     * Counts one more attachment.
+     * @param inherited attachment made by fork, that works for a removed segment too
+     * @return frames of the segment or nullptr if id is not a live segment
+     */
+    const uint32_t * attach(uint32_t id, uint32_t & pages, bool inherited){
+        const uint32_t * frames = nullptr;
+        pthread_mutex_lock(&m_mutex);
+        if (id >= 1 && id <= SEGMENTS && m_segments[id - 1].m_frames && (!m_segments[id - 1].m_removed || inherited)){
+            frames = m_segments[id - 1].m_frames;
+            pages = m_segments[id - 1].m_pages;
+            m_segments[id - 1].m_attached++;
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return frames;
+    }
+    /**
+     * Drops one attachment.
+     * @return frames the caller has to free (and delete[]) if that was the last use of a removed segment, else nullptr
+     */
+    uint32_t * detach(uint32_t id, uint32_t & pages){
+        pthread_mutex_lock(&m_mutex);
+        m_segments[id - 1].m_attached--;
+        uint32_t * frames = releaseLocked(m_segments[id - 1], pages);
+        pthread_mutex_unlock(&m_mutex);
+        return frames;
+    }
+    /**
+     * Marks the segment removed, it disappears with its last attachment and cannot be attached any more.
+     * @return false if id is not a live segment
+     */
+    bool remove(uint32_t id, uint32_t * & frames, uint32_t & pages){
+        frames = nullptr;
+        pthread_mutex_lock(&m_mutex);
+        bool found = id >= 1 && id <= SEGMENTS && m_segments[id - 1].m_frames && !m_segments[id - 1].m_removed;
+        if (found){
+            m_segments[id - 1].m_removed = true;
+            frames = releaseLocked(m_segments[id - 1], pages);
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return found;
+    }
+    /** Segments nobody removed die with MemMgr, their frames go with framePool. */
+    void done(){
+        for (uint32_t i = 0; i < SEGMENTS; i++){
+            delete[] m_segments[i].m_frames;
+            m_segments[i] = TSegment();
+        }
+    }
+} shmTable;
+////-----------------------------------------------------------------------------------------------------------CFileTable
+/**
+ * Host files backing MapFile regions. A file is opened for every MapFile call and stays open while some region
+ * (split parts and forked copies included) refers to it. Its size is taken at open, pages past the end read as
+ * zeros and are never written back, the file does not grow. Page replacement keeps such pages in zram or swap.
+ */
+static class CFileTable{
 private:
-    uint32_t m_maxSize; // maximum stack size
-    uint32_t m_top;     // index of the top of the stack
-    uint32_t * m_arr;   // data array
-    pthread_mutex_t m_stackMutex; // stack mutex
+    static const uint32_t FILES = 64;
+    struct TFile{
+        int m_fd = -1; // -1 = free slot
+        uint32_t m_refs = 0;
+        off_t m_size = 0;
+    } m_files[FILES];
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+public:
+    /** @return id of the opened file or 0 */
+    uint32_t open(const char * path, bool write){
+        int fd = ::open(path, write ? O_RDWR : O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0){
+            if (fd >= 0) close(fd);
+            return 0;
+        }
+        uint32_t id = 0;
+        pthread_mutex_lock(&m_mutex);
+        for (uint32_t i = 0; i < FILES && id == 0; i++)
+            if (m_files[i].m_fd < 0){
+                m_files[i].m_fd = fd;
+                m_files[i].m_refs = 1;
+                m_files[i].m_size = st.st_size;
+                id = i + 1;
+            }
+        pthread_mutex_unlock(&m_mutex);
+        if (id == 0)
+            close(fd);
+        return id;
+    }
+    void get(uint32_t id){
+        pthread_mutex_lock(&m_mutex);
+        m_files[id - 1].m_refs++;
+        pthread_mutex_unlock(&m_mutex);
+    }
+    void put(uint32_t id){
+        pthread_mutex_lock(&m_mutex);
+        if (--m_files[id - 1].m_refs == 0){
+            close(m_files[id - 1].m_fd);
+            m_files[id - 1] = TFile();
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /** Reads count pages from page on into frames with one system call, the part past the end of file is zeroed. */
+    bool read(uint32_t id, uint32_t page, uint8_t * memStart, const uint32_t * frames, uint32_t count){
+        struct iovec iov[CCPU::PAGE_DIR_ENTRIES];
+        for (uint32_t i = 0; i < count; i++){
+            iov[i].iov_base = memStart + ((size_t) frames[i] << CCPU::OFFSET_BITS);
+            iov[i].iov_len = CCPU::PAGE_SIZE;
+        }
+        ssize_t done = preadv(m_files[id - 1].m_fd, iov, count, (off_t) page * CCPU::PAGE_SIZE);
+        if (done < 0)
+            return false;
+        for (uint32_t i = done / CCPU::PAGE_SIZE; i < count; i++){
+            size_t filled = i == done / CCPU::PAGE_SIZE ? done % CCPU::PAGE_SIZE : 0;
+            memset((uint8_t *) iov[i].iov_base + filled, 0, CCPU::PAGE_SIZE - filled);
+        }
+        return true;
+    }
+    /** @return the page lies wholly inside the file, the rest of a page past or across its end cannot be written */
+    bool whole(uint32_t id, uint32_t page){
+        return (off_t) (page + 1) * CCPU::PAGE_SIZE <= m_files[id - 1].m_size;
+    }
+    /** Writes the page back, only the part inside the file. */
+    bool write(uint32_t id, uint32_t page, const uint8_t * data){
+        off_t pos = (off_t) page * CCPU::PAGE_SIZE, size = m_files[id - 1].m_size;
+        if (pos >= size)
+            return true;
+        size_t len = size - pos < (off_t) CCPU::PAGE_SIZE ? size - pos : CCPU::PAGE_SIZE;
+        return pwrite(m_files[id - 1].m_fd, data, len, pos) == (ssize_t) len;
+    }
+    /** Files of regions nobody unmapped close with MemMgr. */
+    void done(){
+        for (uint32_t i = 0; i < FILES; i++){
+            if (m_files[i].m_fd >= 0)
+                close(m_files[i].m_fd);
+            m_files[i] = TFile();
+        }
+    }
+} fileTable;
+/** Memory can be overcommitted, a frame may then have to be taken away from a process. */
+static bool overcommit(){
+    return swapFile.enabled();
+}
+class CMyCPU;
+/**
+ * Takes a frame away from some process by page replacement, defined with CMyCPU. The page tables of waiter are
+ * unlocked meanwhile, so that other waiting processes can take its pages as well.
+ * busy is set when some page was skipped because its process was using it or its page tables.
+ */
+static uint32_t evictFrame(CMyCPU * waiter, bool & busy);
+////----------------------------------------------------------------------------------------------------------CFrameCache
+/**
+ * Magazine of free frames owned by one simulated CPU, only its thread allocates from it and frees to it.
+ * It refills from and drains to framePool a whole batch at a time. The mutex is contended only when another CPU
+ * has claimed frames that are all sitting in caches and drains them back to the global pool.
+ */
+class CFrameCache{
+private:
+    uint32_t m_frames[2 * CFramePool::BATCH];
+    uint32_t m_count = 0;
+    uint32_t m_zeroFrames[CFramePool::BATCH]; // one batch taken from the zeroed list
+    uint32_t m_zeroCount = 0;
+    pthread_mutex_t m_mutex;
+    CMyCPU * m_owner; // process whose thread uses this cache
+    CFrameCache * m_next = nullptr; // registry of all caches
+    CFrameCache * m_prev = nullptr;
+    static CFrameCache * s_head;
+    static pthread_mutex_t s_registryMutex;
+    /** Frame from this cache or from framePool, cleared is set when it comes from the zeroed list. */
+    uint32_t grab(bool zeroed, bool & cleared){
+        uint32_t frame = NO_FRAME;
+        pthread_mutex_lock(&m_mutex);
+        if (zeroed && m_zeroCount == 0)
+            m_zeroCount = framePool.popBatch(m_zeroFrames, true);
+        if (zeroed && m_zeroCount > 0)
+            frame = m_zeroFrames[--m_zeroCount];
+        else {
+            if (m_count == 0)
+                m_count = framePool.popBatch(m_frames);
+            // the rest of free memory may be zeroed already
+            if (m_count == 0 && m_zeroCount == 0)
+                m_zeroCount = framePool.popBatch(m_zeroFrames, true);
+            if (m_count > 0){
+                frame = m_frames[--m_count];
+                cleared = false;
+            } else if (m_zeroCount > 0){
+                frame = m_zeroFrames[--m_zeroCount];
+                cleared = true;
+            }
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return frame;
+    }
+    /** Caller holds m_mutex. */
+    void drainLocked(uint32_t keep){
+        while (m_count > keep){
+            uint32_t count = m_count - keep < CFramePool::BATCH ? m_count - keep : CFramePool::BATCH;
+            m_count -= count;
+            framePool.pushBatch(m_frames + m_count, count);
+        }
+    }
+    /** Caller holds m_mutex. */
+    void drainZeroedLocked(){
+        if (m_zeroCount > 0)
+            framePool.pushBatch(m_zeroFrames, m_zeroCount, true);
+        m_zeroCount = 0;
+    }
+public:
+    static void drainAll(){
+        pthread_mutex_lock(&s_registryMutex);
+        for (CFrameCache * c = s_head; c; c = c->m_next){
+            pthread_mutex_lock(&c->m_mutex);
+            c->drainLocked(0);
+            c->drainZeroedLocked();
+            pthread_mutex_unlock(&c->m_mutex);
+        }
+        pthread_mutex_unlock(&s_registryMutex);
+    }
+    explicit CFrameCache(CMyCPU * owner) : m_owner(owner){
+        pthread_mutex_init(&m_mutex, nullptr);
+        pthread_mutex_lock(&s_registryMutex);
+        m_next = s_head;
+        if (s_head) s_head->m_prev = this;
+        s_head = this;
+        pthread_mutex_unlock(&s_registryMutex);
+    }
+    ~CFrameCache(){
+        drain();
+        pthread_mutex_lock(&s_registryMutex);
+        if (m_prev) m_prev->m_next = m_next;
+        else s_head = m_next;
+        if (m_next) m_next->m_prev = m_prev;
+        pthread_mutex_unlock(&s_registryMutex);
+        pthread_mutex_destroy(&m_mutex);
+    }
+    CCounter<uint64_t> m_popped; // frames handed out and taken back by the owner, for MemMgrStats
+    CCounter<uint64_t> m_pushed;
+    /**
+     * Frame for a claim made by framePool.take. Without overcommit the claim guarantees that a free frame exists
+     * somewhere, with it the frame may have to be taken away from some process. When a whole pass of page replacement
+     * finds nothing to evict, skips no page in use and no frame has come back to framePool since the previous pass,
+     * the claim cannot be met now and the caller gives it back.
+     * A zeroed frame comes from the zeroed list if possible, otherwise any frame is cleared here.
+     * @return frame or NO_FRAME
+     */
+    uint32_t pop(bool zeroed = false){
+        bool cleared = true, busy = true;
+        uint32_t frame = grab(zeroed, cleared), returned = 0;
+        while (frame == NO_FRAME){
+            // the claimed frame waits in another cache, with swap it may also be in use by a process that overcommitted
+            uint32_t now = framePool.returned();
+            drainAll();
+            if ((frame = grab(zeroed, cleared)) != NO_FRAME || !overcommit())
+                continue;
+            // a pass that evicted nothing is repeated while pages are in use or frames come back, e.g. from ending processes
+            if (!busy && now == returned)
+                break;
+            returned = now;
+            busy = false;
+            frame = evictFrame(m_owner, busy);
+            cleared = false;
+        }
+        if (frame == NO_FRAME)
+            return NO_FRAME;
+        if (zeroed && !cleared) framePool.clear(frame);
+        m_popped++;
+        return frame;
+    }
+    void push(uint32_t frame){
+        pthread_mutex_lock(&m_mutex);
+        if (m_count == 2 * CFramePool::BATCH)
+            drainLocked(CFramePool::BATCH);
+        m_frames[m_count++] = frame;
+        pthread_mutex_unlock(&m_mutex);
+        m_pushed++;
+    }
+    void drain(){
+        pthread_mutex_lock(&m_mutex);
+        drainLocked(0);
+        drainZeroedLocked();
+        pthread_mutex_unlock(&m_mutex);
+    }
+};
+CFrameCache * CFrameCache::s_head = nullptr;
+pthread_mutex_t CFrameCache::s_registryMutex = PTHREAD_MUTEX_INITIALIZER;
+////---------------------------------------------------------------------------------------------------------CFrameTable
+static class CFrameTable{
+private:
+    uint32_t * m_refs;  // number of page table entries mapping each frame
+    CMyCPU ** m_owner;  // reverse map for page replacement: the process mapping an unshared data frame
+    uint32_t * m_vpn;   // and the virtual page it is mapped at
+    uint32_t * m_claims; // framePool claims of pages merged into the frame, a copy on write or unmap takes one back
 public:
-    void deleteStack(){delete[] m_arr;}
     void init(uint32_t totalPages){
-        m_maxSize = totalPages;
-        m_top = totalPages - 1;
-        m_arr = new uint32_t [m_maxSize];
-        pthread_mutex_init(&m_stackMutex, nullptr);
-        for (uint32_t i = 0; i < m_maxSize; ++i)
-            m_arr[i] = m_maxSize - (i+1);
-    }
-    void lock(){pthread_mutex_lock(&m_stackMutex);}
-    void unlock(){pthread_mutex_unlock(&m_stackMutex);}
-    uint32_t size(){return m_top + 1;}
-    void push(uint32_t x){ if (m_top + 1 < m_maxSize) m_arr[++m_top] = x; }
-    uint32_t pop(){ if (m_top >= 0) return m_arr[m_top--]; }
-} pageStack;
-////-------------------------------------------------------------------------------------------------------------Globals
-uint32_t runningProcess = 0;
-pthread_mutex_t runningMtx = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t runningCond = PTHREAD_COND_INITIALIZER;
-////--------------------------------------------------------------------------------------------------------------CMyCPU
-class CMyCPU : public CCPU {
+        m_refs = new uint32_t [totalPages];
+        m_owner = new CMyCPU * [totalPages];
+        m_vpn = new uint32_t [totalPages];
+        m_claims = new uint32_t [totalPages];
+        memset(m_refs, 0, totalPages * sizeof(uint32_t));
+        memset(m_owner, 0, totalPages * sizeof(CMyCPU *));
+        memset(m_vpn, 0, totalPages * sizeof(uint32_t));
+        memset(m_claims, 0, totalPages * sizeof(uint32_t));
+    }
+    void deleteTable(){delete[] m_refs; delete[] m_owner; delete[] m_vpn; delete[] m_claims;}
+    uint32_t refs(uint32_t frame){ return __atomic_load_n(&m_refs[frame], __ATOMIC_ACQUIRE); }
+    /** Sets the references of a frame that is new or free, it keeps no claims. */
+    void set(uint32_t frame, uint32_t refs){
+        __atomic_store_n(&m_claims[frame], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_refs[frame], refs, __ATOMIC_RELEASE);
+    }
+    void get(uint32_t frame){ __atomic_add_fetch(&m_refs[frame], 1, __ATOMIC_ACQ_REL); }
+    uint32_t put(uint32_t frame){ return __atomic_sub_fetch(&m_refs[frame], 1, __ATOMIC_ACQ_REL); }
+    /** Adds a reference only to a frame mapped more than once, such a frame cannot be freed until it is put again. */
+    bool getShared(uint32_t frame){
+        uint32_t cur = refs(frame);
+        while (cur >= 2)
+            if (__atomic_compare_exchange_n(&m_refs[frame], &cur, cur + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return true;
+        return false;
+    }
+    uint32_t claims(uint32_t frame){ return __atomic_load_n(&m_claims[frame], __ATOMIC_ACQUIRE); }
+    void addClaim(uint32_t frame){ __atomic_add_fetch(&m_claims[frame], 1, __ATOMIC_ACQ_REL); }
+    /** Takes back one claim the frame keeps, before the caller drops its reference. @return false if it keeps none */
+    bool takeClaim(uint32_t frame){
+        uint32_t cur = claims(frame);
+        while (cur > 0)
+            if (__atomic_compare_exchange_n(&m_claims[frame], &cur, cur - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return true;
+        return false;
+    }
+    /** Called by the owner with its page tables locked. */
+    void map(uint32_t frame, CMyCPU * owner, uint32_t vpn){
+        __atomic_store_n(&m_vpn[frame], vpn, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_owner[frame], owner, __ATOMIC_RELEASE);
+    }
+    void unmap(uint32_t frame, CMyCPU * owner){
+        CMyCPU * expected = owner;
+        __atomic_compare_exchange_n(&m_owner[frame], &expected, (CMyCPU *) nullptr, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    CMyCPU * owner(uint32_t frame){ return __atomic_load_n(&m_owner[frame], __ATOMIC_ACQUIRE); }
+    /** Read before locking the mappers, the caller checks it against their page tables. */
+    uint32_t vpn(uint32_t frame){ return __atomic_load_n(&m_vpn[frame], __ATOMIC_RELAXED); }
+} frameTable;
+////--------------------------------------------------------------------------------------------------------------CMerge
+/** Merges the page in frame with an equal one if there is any, defined with CMyCPU. */
+static void mergeFrame(uint32_t frame);
+/**
+ * Same-page merging. A background thread hands m_scan frames per pass to mergeFrame, then sleeps m_sleep ms.
+ * A page is merged only when its checksum is the same as on the previous visit, pages that keep changing are skipped.
+ * The stable table keeps merged frames by checksum, a slot is valid while its frame is mapped more than once (all
+ * such mappings are read only). The unstable table keeps candidates seen in the current pass over all frames and is
+ * cleared when the pass wraps around, a candidate is verified against the page contents before it is used.
+ * Both tables are open addressed with a bounded probe, a checksum that finds no room is just not recorded.
+ */
+static class CMerge{
 private:
-    uint32_t m_CurrentPagesUsed = 0; // celkovy pocet stranek k dispozici (L1 a L2 se nezapocitava)
-    uint32_t m_L2PagesUsed = 0; // pocet stranek v root tabulce
-    uint32_t * m_RootPageAddr = nullptr; // pointer na root tabulku
+    static const uint32_t PROBES = 16;
+    struct TSlot{
+        uint32_t m_sum;
+        uint32_t m_frame; // NO_FRAME = empty
+    };
+    uint8_t * m_memStart;
+    uint32_t m_totalPages;
+    uint32_t m_mask;
+    uint32_t * m_sums = nullptr;   // checksum of every frame at its last visit
+    uint32_t * m_stableSlot;       // stable slot + 1 of every frame, a slot is valid only if its frame points back
+    TSlot * m_stable;
+    TSlot * m_unstable;
+    uint32_t m_scan;
+    uint32_t m_sleep;
+    uint32_t m_cursor = 0;
+    uint32_t m_scanned = 0;
+    uint32_t m_merged = 0;
+    bool m_run = false;
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER; // guards the tables against stats()
+    pthread_mutex_t m_runMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t m_runCond = PTHREAD_COND_INITIALIZER;
+    static void * scanMain(void * merge);
+    const uint8_t * page(uint32_t frame){ return m_memStart + (frame << CCPU::OFFSET_BITS); }
+    void clear(TSlot * table){
+        for (uint32_t i = 0; i <= m_mask; i++)
+            table[i].m_frame = NO_FRAME;
+    }
+public:
+    void init(uint8_t * memStart, uint32_t totalPages, uint32_t scan, uint32_t sleep){
+        if (scan == 0)
+            return;
+        m_memStart = memStart;
+        m_totalPages = totalPages;
+        m_scan = scan;
+        m_sleep = sleep;
+        m_cursor = m_scanned = m_merged = 0;
+        uint32_t size = 1;
+        while (size < 2 * totalPages)
+            size <<= 1;
+        m_mask = size - 1;
+        m_sums = new uint32_t [totalPages];
+        m_stableSlot = new uint32_t [totalPages];
+        m_stable = new TSlot [size];
+        m_unstable = new TSlot [size];
+        memset(m_sums, 0, totalPages * sizeof(uint32_t));
+        memset(m_stableSlot, 0, totalPages * sizeof(uint32_t));
+        clear(m_stable);
+        clear(m_unstable);
+        m_run = true;
+        pthread_create(&m_thread, nullptr, scanMain, this);
+    }
+    /** Stops the thread, called before the processes are gone. */
+    void stop(){
+        if (!m_sums)
+            return;
+        pthread_mutex_lock(&m_runMutex);
+        m_run = false;
+        pthread_cond_signal(&m_runCond);
+        pthread_mutex_unlock(&m_runMutex);
+        pthread_join(m_thread, nullptr);
+    }
+    void done(){
+        if (!m_sums)
+            return;
+        delete[] m_sums;
+        delete[] m_stableSlot;
+        delete[] m_stable;
+        delete[] m_unstable;
+        m_sums = nullptr;
+    }
+    /** FNV-1a over the words of the page. */
+    uint32_t checksum(uint32_t frame){
+        auto * words = (const uint32_t *) page(frame);
+        uint32_t sum = 2166136261u;
+        for (uint32_t i = 0; i < CCPU::PAGE_SIZE / 4; i++)
+            sum = (sum ^ words[i]) * 16777619u;
+        return sum;
+    }
+    /** Records the checksum of frame. @return whether the page has not changed since the previous visit */
+    bool steady(uint32_t frame, uint32_t sum){
+        bool same = m_sums[frame] == sum;
+        m_sums[frame] = sum;
+        return same;
+    }
+    bool same(uint32_t a, uint32_t b){ return memcmp(page(a), page(b), CCPU::PAGE_SIZE) == 0; }
+    /** @return merged frame with the same contents as frame, already with a reference for the caller, or NO_FRAME */
+    uint32_t findStable(uint32_t sum, uint32_t frame){
+        pthread_mutex_lock(&m_mutex);
+        uint32_t found = NO_FRAME;
+        for (uint32_t i = sum & m_mask, n = 0; n < PROBES && found == NO_FRAME && m_stable[i].m_frame != NO_FRAME;
+             i = (i + 1) & m_mask, n++){
+            uint32_t target = m_stable[i].m_frame;
+            if (m_stable[i].m_sum != sum || m_stableSlot[target] != i + 1 || target == frame
+                || !frameTable.getShared(target))
+                continue;
+            if (same(target, frame))
+                found = target;
+            else if (frameTable.put(target) == 0){
+                // the other mappings went away meanwhile
+                framePool.pushBatch(&target, 1);
+                framePool.give(1);
+            }
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return found;
+    }
+    /** Records frame as merged, in place of a slot that is empty or no longer valid. */
+    void addStable(uint32_t sum, uint32_t frame){
+        pthread_mutex_lock(&m_mutex);
+        for (uint32_t i = sum & m_mask, n = 0; n < PROBES; i = (i + 1) & m_mask, n++){
+            TSlot & slot = m_stable[i];
+            if (slot.m_frame != NO_FRAME && m_stableSlot[slot.m_frame] == i + 1){
+                if (frameTable.refs(slot.m_frame) >= 2)
+                    continue;
+                m_stableSlot[slot.m_frame] = 0;
+            }
+            slot.m_sum = sum;
+            slot.m_frame = frame;
+            m_stableSlot[frame] = i + 1;
+            break;
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+    /** @return candidate of this pass with the same checksum, or NO_FRAME and frame becomes a candidate itself */
+    uint32_t findUnstable(uint32_t sum, uint32_t frame){
+        for (uint32_t i = sum & m_mask, n = 0; n < PROBES; i = (i + 1) & m_mask, n++){
+            TSlot & slot = m_unstable[i];
+            if (slot.m_frame == NO_FRAME){
+                slot.m_sum = sum;
+                slot.m_frame = frame;
+                break;
+            }
+            if (slot.m_sum == sum && slot.m_frame != frame)
+                return slot.m_frame;
+        }
+        return NO_FRAME;
+    }
+    void merged(){ __atomic_add_fetch(&m_merged, 1, __ATOMIC_RELAXED); }
+    void stats(TMemMergeStats & stats){
+        memset(&stats, 0, sizeof(stats));
+        if (!m_sums)
+            return;
+        stats.m_Scanned = __atomic_load_n(&m_scanned, __ATOMIC_RELAXED);
+        stats.m_Merged = __atomic_load_n(&m_merged, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&m_mutex);
+        for (uint32_t i = 0; i <= m_mask; i++){
+            uint32_t frame = m_stable[i].m_frame, refs;
+            if (frame != NO_FRAME && m_stableSlot[frame] == i + 1 && (refs = frameTable.refs(frame)) >= 2){
+                stats.m_Shared++;
+                stats.m_Saved += refs - 1;
+            }
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+} mergeScanner;
+void * CMerge::scanMain(void * merge){
+    auto * self = (CMerge *) merge;
+    pthread_mutex_lock(&self->m_runMutex);
+    while (self->m_run){
+        pthread_mutex_unlock(&self->m_runMutex);
+        for (uint32_t n = 0; n < self->m_scan; n++){
+            mergeFrame(self->m_cursor);
+            if (++self->m_cursor == self->m_totalPages){
+                self->m_cursor = 0;
+                self->clear(self->m_unstable);
+            }
+        }
+        __atomic_add_fetch(&self->m_scanned, self->m_scan, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&self->m_runMutex);
+        if (!self->m_run)
+            break;
+        timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += self->m_sleep / 1000;
+        until.tv_nsec += (self->m_sleep % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000){ until.tv_sec++; until.tv_nsec -= 1000000000; }
+        pthread_cond_timedwait(&self->m_runCond, &self->m_runMutex, &until);
+    }
+    pthread_mutex_unlock(&self->m_runMutex);
+    return nullptr;
+}
+////---------------------------------------------------------------------------------------------------------CRegionTree
+/**
+ * Interval tree of the mapped regions of one process: AVL tree of disjoint page intervals ordered by the first page,
+ * every node keeps the largest end in its subtree, so an overlap query descends one path only.
+ * The owning process guards it with its page table lock.
+ */
+class CRegionTree{
+public:
+    struct TRegion{
+        uint32_t m_Start; // first page
+        uint32_t m_End;   // page after the last one
+        uint32_t m_Shm;   // attached shared segment, 0 = anonymous memory
+        bool m_Write;
+        uint32_t m_File;   // fileTable id of a file backing the region, 0 = none
+        uint32_t m_Offset; // file page mapped at m_Start
+    };
 private:
-    struct thread_args{
-        void (* entryPoint)(CCPU *, void *);
-        CCPU * ccpu;
-        void * processArgs;
-        thread_args(void (* ep)(CCPU *, void *),CCPU * cpu, void * pArgs ):entryPoint(ep),ccpu(cpu),processArgs(pArgs){}
+    struct TNode{
+        TRegion m_Region;
+        uint32_t m_MaxEnd;
+        int m_Height;
+        TNode * m_Left;
+        TNode * m_Right;
+    };
+    TNode * m_Root = nullptr;
+    static int height(const TNode * n){ return n ? n->m_Height : 0; }
+    static void update(TNode * n){
+        n->m_Height = 1 + (height(n->m_Left) > height(n->m_Right) ? height(n->m_Left) : height(n->m_Right));
+        n->m_MaxEnd = n->m_Region.m_End;
+        if (n->m_Left && n->m_Left->m_MaxEnd > n->m_MaxEnd) n->m_MaxEnd = n->m_Left->m_MaxEnd;
+        if (n->m_Right && n->m_Right->m_MaxEnd > n->m_MaxEnd) n->m_MaxEnd = n->m_Right->m_MaxEnd;
+    }
+    static TNode * rotateRight(TNode * n){
+        TNode * l = n->m_Left;
+        n->m_Left = l->m_Right;
+        l->m_Right = n;
+        update(n);
+        update(l);
+        return l;
+    }
+    static TNode * rotateLeft(TNode * n){
+        TNode * r = n->m_Right;
+        n->m_Right = r->m_Left;
+        r->m_Left = n;
+        update(n);
+        update(r);
+        return r;
+    }
+    static TNode * balance(TNode * n){
+        update(n);
+        int diff = height(n->m_Left) - height(n->m_Right);
+        if (diff > 1){
+            if (height(n->m_Left->m_Left) < height(n->m_Left->m_Right))
+                n->m_Left = rotateLeft(n->m_Left);
+            return rotateRight(n);
+        }
+        if (diff < -1){
+            if (height(n->m_Right->m_Right) < height(n->m_Right->m_Left))
+                n->m_Right = rotateRight(n->m_Right);
+            return rotateLeft(n);
+        }
+        return n;
+    }
+    static TNode * insert(TNode * n, TNode * node){
+        if (!n)
+            return node;
+        if (node->m_Region.m_Start < n->m_Region.m_Start)
+            n->m_Left = insert(n->m_Left, node);
+        else
+            n->m_Right = insert(n->m_Right, node);
+        return balance(n);
+    }
+    static TNode * removeMin(TNode * n, TNode * & min){
+        if (!n->m_Left){
+            min = n;
+            return n->m_Right;
+        }
+        n->m_Left = removeMin(n->m_Left, min);
+        return balance(n);
+    }
+    static TNode * erase(TNode * n, uint32_t start){
+        if (!n)
+            return nullptr;
+        if (start < n->m_Region.m_Start)
+            n->m_Left = erase(n->m_Left, start);
+        else if (start > n->m_Region.m_Start)
+            n->m_Right = erase(n->m_Right, start);
+        else {
+            TNode * l = n->m_Left, * r = n->m_Right, * min;
+            delete n;
+            if (!r)
+                return l;
+            r = removeMin(r, min);
+            min->m_Left = l;
+            min->m_Right = r;
+            return balance(min);
+        }
+        return balance(n);
+    }
+    static void clear(TNode * n){
+        if (!n)
+            return;
+        clear(n->m_Left);
+        clear(n->m_Right);
+        delete n;
+    }
+public:
+    CRegionTree() = default;
+    CRegionTree(const CRegionTree &) = delete;
+    CRegionTree & operator = (const CRegionTree &) = delete;
+    ~CRegionTree(){ clear(m_Root); }
+    /** The caller has checked that the region overlaps no other. */
+    void insert(const TRegion & region){
+        m_Root = insert(m_Root, new TNode{region, region.m_End, 1, nullptr, nullptr});
+    }
+    void erase(uint32_t start){ m_Root = erase(m_Root, start); }
+    /**
+     * Regions are disjoint, so the largest end in a left subtree belongs to its last region: when it reaches past
+     * start, either that region overlaps or nothing does.
+     * @return region with the lowest start overlapping the pages [start, end), nullptr if there is none
+     */
+    const TRegion * overlap(uint32_t start, uint32_t end) const{
+        for (const TNode * n = m_Root; n; ){
+            if (n->m_Left && n->m_Left->m_MaxEnd > start)
+                n = n->m_Left;
+            else if (n->m_Region.m_Start >= end)
+                return nullptr;
+            else if (n->m_Region.m_End > start)
+                return &n->m_Region;
+            else
+                n = n->m_Right;
+        }
+        return nullptr;
+    }
+    /** @return first region ending after page start, regions are walked by next(region->m_End) */
+    const TRegion * next(uint32_t start) const{ return overlap(start, ~0u); }
+};
+////--------------------------------------------------------------------------------------------------------CProcessPool
+/**
+ * Threads running the simulated processes. A thread that has finished a process waits for the next one instead of
+ * exiting, a new thread is started only when the queued processes outnumber the waiting threads. With a limit
+ * (m_size) processes past it wait in the queue for a thread to free up, without one every such process gets a thread.
+ * The same mutex counts the processes not finished yet, MemMgr waits for them on m_doneCond. The threads live until
+ * done() at the end of MemMgr.
+ */
+static class CProcessPool{
+public:
+    /** Queue link, lives in the process itself. */
+    struct TJob{
+        void (* m_entry)(CCPU *, void *);
+        CCPU * m_cpu; // deleted when the entry point returns, together with the job
+        void * m_arg;
+        TJob * m_next;
     };
-    static void * thread_args_wrapper(void * voidArgs){
+private:
+    pthread_t * m_threads = nullptr;
+    uint32_t m_size;    // most threads to start, 0 = no limit
+    uint32_t m_capacity;
+    uint32_t m_started;
+    uint32_t m_idle;    // threads waiting for a job
+    uint32_t m_queued;
+    uint32_t m_pending; // processes queued or running
+    TJob * m_head;
+    TJob * m_tail;
+    bool m_stop;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t m_jobCond = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t m_doneCond = PTHREAD_COND_INITIALIZER;
+    static void * threadMain(void * pool);
+    /** Room for one more thread in m_threads, the array grows only without a limit. Caller holds m_mutex. */
+    void reserveLocked(){
+        if (m_started < m_capacity)
+            return;
+        auto * threads = new pthread_t [2 * m_capacity];
+        memcpy(threads, m_threads, m_started * sizeof(*threads));
+        delete[] m_threads;
+        m_threads = threads;
+        m_capacity *= 2;
+    }
+public:
+    void init(uint32_t size){
+        m_size = size;
+        m_capacity = size ? size : PROCESS_MAX;
+        m_threads = new pthread_t [m_capacity];
+        m_started = m_idle = m_queued = m_pending = 0;
+        m_head = m_tail = nullptr;
+        m_stop = false;
+    }
+    /**
+     * Queues the job and starts a new thread for it if none is idle and the limit allows it. When the thread cannot
+     * be created, the job waits for one of the running threads.
+     * @return false if no thread exists that could ever run the job, it is then not queued
+     */
+    bool submit(TJob * job){
+        job->m_next = nullptr;
+        pthread_mutex_lock(&m_mutex);
+        bool grow = m_queued >= m_idle && (m_size == 0 || m_started < m_size);
+        if (grow) reserveLocked();
+        if (grow && pthread_create(&m_threads[m_started], nullptr, threadMain, this) == 0)
+            m_started++;
+        else if (m_started == 0){
+            pthread_mutex_unlock(&m_mutex);
+            return false;
+        }
+        if (m_tail) m_tail->m_next = job;
+        else m_head = job;
+        m_tail = job;
+        m_queued++;
+        m_pending++;
+        pthread_cond_signal(&m_jobCond);
+        pthread_mutex_unlock(&m_mutex);
+        return true;
+    }
+    /** Waits until all submitted processes have finished. */
+    void wait(){
+        pthread_mutex_lock(&m_mutex);
+        while (m_pending != 0)
+            pthread_cond_wait(&m_doneCond, &m_mutex);
+        pthread_mutex_unlock(&m_mutex);
+    }
+    void done(){
+        pthread_mutex_lock(&m_mutex);
+        m_stop = true;
+        pthread_cond_broadcast(&m_jobCond);
+        pthread_mutex_unlock(&m_mutex);
+        for (uint32_t i = 0; i < m_started; i++)
+            pthread_join(m_threads[i], nullptr);
+        delete[] m_threads;
+        m_threads = nullptr;
+    }
+} processPool;
+void * CProcessPool::threadMain(void * pool){
+    auto * self = (CProcessPool *) pool;
+    pthread_mutex_lock(&self->m_mutex);
+    while (true){
+        while (!self->m_head && !self->m_stop){
+            self->m_idle++;
+            pthread_cond_wait(&self->m_jobCond, &self->m_mutex);
+            self->m_idle--;
+        }
+        TJob * job = self->m_head;
+        if (!job)
+            break;
+        self->m_head = job->m_next;
+        if (!self->m_head) self->m_tail = nullptr;
+        self->m_queued--;
+        pthread_mutex_unlock(&self->m_mutex);
         #ifdef DEBUG_PRINT
         printf("Thread start.\n");
         #endif /*DEBUG_PRINT*/
-        pthread_mutex_lock(&runningMtx);
-        runningProcess++;
-        pthread_mutex_unlock(&runningMtx);
-        auto *args = (thread_args *) voidArgs;
-        args->entryPoint(args->ccpu, args->processArgs);
-        delete args->ccpu;
-        delete args;
-        pthread_mutex_lock(&runningMtx);
-        uint32_t x = --runningProcess;
-        pthread_mutex_unlock(&runningMtx);
-        if (x == 0) pthread_cond_signal(&runningCond);
-        return nullptr;
+        job->m_entry(job->m_cpu, job->m_arg);
+        delete job->m_cpu;
+        pthread_mutex_lock(&self->m_mutex);
+        if (--self->m_pending == 0)
+            pthread_cond_broadcast(&self->m_doneCond);
     }
+    pthread_mutex_unlock(&self->m_mutex);
+    return nullptr;
+}
+////--------------------------------------------------------------------------------------------------------------CMyCPU
+class CMyCPU : public CCPU {
+private:
+    // pocty stranek cte i MemMgrStats z jinych vlaken, proto CCounter
+    CCounter<uint32_t> m_CurrentPagesUsed; // celkovy pocet stranek k dispozici (L1 a L2 se nezapocitava)
+    CCounter<uint32_t> m_L2PagesUsed; // pocet stranek v root tabulce
+    CCounter<uint32_t> m_LazyPages; // stranky rezervovane v framePool, ramec dostanou az pri prvnim pristupu
+    CCounter<uint32_t> m_SwapPages; // stranky odlozene ve swapFile
+    CCounter<uint32_t> m_ZramPages; // stranky zkomprimovane v zram
+    CCounter<uint32_t> m_RegionPages; // stranky oblasti
+    CCounter<uint32_t> m_Tables; // L2 tabulky limitu i oblasti
+    CCounter<uint64_t> m_LazyFaults; // vypadky podle druhu, viz TMemProcStats
+    CCounter<uint64_t> m_FileFaults;
+    CCounter<uint64_t> m_SwapFaults;
+    CCounter<uint64_t> m_ZramFaults;
+    CCounter<uint64_t> m_CowFaults;
+    CCounter<uint64_t> m_ForkBytes; // tabulky zapsane potomkum
+    uint32_t m_Pid; // poradi vzniku od 1 (init)
+    uint32_t * m_RootPageAddr = nullptr; // pointer na root tabulku
+    CFrameCache m_Frames; // volne ramce tohoto procesu, pouziva je jen jeho vlakno
+    CRegionTree m_Regions; // oblasti z MemMap a MapFile a pripojene segmenty, vsechny lezi za m_L2PagesUsed
+    uint32_t m_RaNext = ~0u; // stranka, jejiz vypadek by navazal na posledni cteni souboru
+    uint32_t m_RaWindow = 0; // stranek nactenych pri poslednim cteni souboru
+    CProcessPool::TJob m_Job; // zarazeni procesu do processPool
+    uint32_t * m_Reclaim = nullptr; // pri zaniku procesu se sem sbiraji uvolnene ramce pro jedine pushBatch
+    uint32_t m_Reclaimed = 0;
 public:
     /**
      * Konstruktor inicializuje členské proměnné podle parametrů.
      * Druhým parametrem je rámec stránky, kde je umístěn adresář stránek nejvyšší úrovně
      * (toto nastavení stránkování bude použito pro přepočet adres v tomto simulovaném CPU).
      * @param memStart "opravdový" ukazatel na počátek bloku paměti, který byl simulaci předán při volání MemMgr.
-     * @param pageTableRootIndex
+     * @param pageTableRootIndex root tabulka, ramec uz musi byt vynulovany
      */
-    CMyCPU(uint8_t *memStart, uint32_t pageTableRootIndex):CCPU(memStart, pageTableRootIndex){
+    CMyCPU(uint8_t *memStart, uint32_t pageTableRootIndex):CCPU(memStart, pageTableRootIndex), m_Frames(this){
         m_RootPageAddr = (uint32_t *) (m_MemStart + (m_PageTableRoot & ADDR_MASK));
-        memset(m_RootPageAddr, 0,  PAGE_SIZE);
+        m_TableShared = overcommit() || g_Config.m_Compaction || g_Config.m_MergeScan != 0;
+        pthread_mutex_lock(&s_EvictMtx);
+        m_Pid = ++s_Created;
+        m_Next = s_Processes;
+        if (s_Processes) s_Processes->m_Prev = this;
+        s_Processes = this;
+        pthread_mutex_unlock(&s_EvictMtx);
     }
     virtual ~CMyCPU(){
-        pageStack.lock();
-        pageStack.push(m_PageTableRoot >> OFFSET_BITS);
-        pageStack.unlock();
+        // po odregistrovani z reverse map a seznamu procesu uz se k procesu nedostane zadny evictFrame
+        tableLock();
+        // ramce procesu (data, tabulky, posledni reference sdilenych a copy-on-write ramcu) se sesbiraji do m_Reclaim
+        // a do framePool se vrati jednim pushBatch, kazda polozka uvolni nejvys jeden ramec
+        uint32_t bound = m_CurrentPagesUsed + m_L2PagesUsed + 1;
+        for (const CRegionTree::TRegion * r = m_Regions.next(0); r; r = m_Regions.next(r->m_End))
+            bound += r->m_End - r->m_Start + (r->m_End - 1) / PAGE_DIR_ENTRIES - r->m_Start / PAGE_DIR_ENTRIES + 1;
+        m_Reclaim = new uint32_t [bound];
+        while (const CRegionTree::TRegion * region = m_Regions.next(0))
+            removeRegion(*region);
+        removePages(0);
+        // root tabulka je uz prazdna, do framePool se dostane az s ostatnimi
+        freeFrame(m_PageTableRoot >> OFFSET_BITS);
+        pthread_mutex_lock(&s_EvictMtx);
+        if (m_Prev) m_Prev->m_Next = m_Next;
+        else s_Processes = m_Next;
+        if (m_Next) m_Next->m_Prev = m_Prev;
+        TMemProcStats counters;
+        snapshot(counters);
+        addCounters(s_Exited, counters);
+        pthread_mutex_unlock(&s_EvictMtx);
+        tableUnlock();
+        framePool.pushBatch(m_Reclaim, m_Reclaimed);
+        delete[] m_Reclaim;
     }
     /**
      * Metoda GetMemLimit zjistí, kolik stránek má alokovaných proces, pro který je používána tato instance CCPU.
@@ -102,45 +1642,74 @@ public:
     virtual bool SetMemLimit(uint32_t pages){
         #ifdef DEBUG_PRINT
         printf("\n");
-        printf("Current: %d -> ", m_CurrentPagesUsed);
+        printf("Current: %u -> ", (uint32_t) m_CurrentPagesUsed);
         printf("Set to: %d\n", pages);
         #endif /*DEBUG_PRINT*/
-        pageStack.lock();
-        if (m_CurrentPagesUsed < pages){
-            bool res = addPages(pages);
-            pageStack.unlock();
-            return res;
-        } else if (m_CurrentPagesUsed > pages){
-            bool res = removePages(pages);
-            pageStack.unlock();
-            return res;
-        }
-        pageStack.unlock();
-        return true;
+        bool res = true;
+        tableLock();
+        if (m_CurrentPagesUsed < pages)
+            res = addPages(pages);
+        else if (m_CurrentPagesUsed > pages)
+            res = removePages(pages);
+        tableUnlock();
+        return res;
     }
     bool addPages(uint32_t pages){
         uint32_t l2pages = int(pages / PAGE_DIR_ENTRIES) + (1 * (pages % PAGE_DIR_ENTRIES != 0)); // zjistim kolik L2 tabulek potrebuju
         uint32_t pagesToAdd = pages - m_CurrentPagesUsed; // kolik stranek musim pridat
         uint32_t l2Filled = m_CurrentPagesUsed % PAGE_DIR_ENTRIES;
-        if (pagesToAdd + (l2pages - m_L2PagesUsed) > pageStack.size()){
+        // oblasti za limitem mohou patrit pripojenym segmentum
+        for (uint32_t i = m_L2PagesUsed; i < l2pages && i < PAGE_DIR_ENTRIES; i++)
+            if (m_RootPageAddr[i] != 0)
+                return false;
+        // cele nove oblasti po 1024 strankach dostanou velkou stranku, dokud jsou v largePool
+        uint32_t runs[PAGE_DIR_ENTRIES], large = 0;
+        for (uint32_t i = m_L2PagesUsed; largePool.enabled() && (i + 1) * PAGE_DIR_ENTRIES <= pages; i++)
+            if ((runs[large] = largePool.alloc()) == NO_FRAME)
+                break;
+            else
+                large++;
+        // jeden globalni zapis na cely pozadavek, ramce pak jdou z m_Frames
+        uint32_t claimed = pagesToAdd - large * PAGE_DIR_ENTRIES + (l2pages - m_L2PagesUsed - large);
+        uint32_t tables[PAGE_DIR_ENTRIES], tableCount = l2pages - m_L2PagesUsed - large;
+        bool failed = !framePool.take(claimed);
+        // ramce L2 tabulek se vezmou predem, kdyz nejsou, tabulky zustanou beze zmeny
+        for (uint32_t i = 0; !failed && i < tableCount; i++)
+            if ((tables[i] = m_Frames.pop(true)) == NO_FRAME){
+                while (i > 0)
+                    m_Frames.push(tables[--i]);
+                framePool.give(claimed);
+                failed = true;
+            }
+        if (failed){
+            for (uint32_t i = 0; i < large; i++)
+                largePool.free(runs[i]);
             return false;
         }
         #ifdef DEBUG_PRINT
         printf("need: %u, toAdd: %u\n", l2pages, pagesToAdd);
         #endif /*DEBUG_PRINT*/
+        uint32_t oldPages = m_CurrentPagesUsed;
         uint32_t l1Size = m_CurrentPagesUsed / PAGE_DIR_ENTRIES;
         bool toFill = m_RootPageAddr[l1Size] != 0;
         // naplnit root tabulku
-        for (uint32_t i = m_L2PagesUsed; i < l2pages; ++i) {
-            m_RootPageAddr[i] = (pageStack.pop() << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
-            memset((uint32_t *) (m_MemStart + (m_RootPageAddr[i] & ADDR_MASK)), 0, PAGE_SIZE);
+        for (uint32_t i = m_L2PagesUsed, r = 0, t = 0; i < l2pages; ++i) {
+            if (r < large){
+                // lazy stranky jsou pri prvnim pristupu vynulovane, velka stranka se tedy nuluje hned
+                if (g_Config.m_LazyAlloc)
+                    memset(m_MemStart + (runs[r] << OFFSET_BITS), 0, PAGE_SIZE * PAGE_DIR_ENTRIES);
+                m_RootPageAddr[i] = (runs[r++] << OFFSET_BITS) | BIT_LARGE | BIT_USER | BIT_WRITE | BIT_PRESENT;
+            } else {
+                m_RootPageAddr[i] = (tables[t++] << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+                m_Tables++;
+            }
             m_L2PagesUsed++;
         }
         // posledni l2 tabulka neni plna
         if (toFill){
             uint32_t *level2 = (uint32_t *) (m_MemStart + (m_RootPageAddr[l1Size++] & ADDR_MASK));
             for (uint32_t  i = l2Filled; i < PAGE_DIR_ENTRIES && pagesToAdd > 0; ++i) {
-                level2[i] = (pageStack.pop() << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+                level2[i] = fillEntry((l1Size - 1) * PAGE_DIR_ENTRIES + i, true, false, failed);
                 #ifdef DEBUG_PRINT
                 printf("root[%u][%u] = %u\n",l1Size-1,i , level2[i]>>12);
                 #endif /*DEBUG_PRINT*/
@@ -150,10 +1719,14 @@ public:
         // posledni l2 tabulka jiz je naplnena
         // plnim dalsi L2 tabulky az do po
         for (uint32_t i = l1Size; i < l2pages; ++i) {
+            if (m_RootPageAddr[i] & BIT_LARGE){
+                pagesToAdd -= PAGE_DIR_ENTRIES;
+                continue;
+            }
             auto *level2 = (uint32_t *) (m_MemStart + (m_RootPageAddr[i] & ADDR_MASK));
             uint32_t j;
             for ( j = 0; j < PAGE_DIR_ENTRIES && j < pagesToAdd; ++j) {
-                level2[j] = (pageStack.pop() << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+                level2[j] = fillEntry(i * PAGE_DIR_ENTRIES + j, true, false, failed);
                 #ifdef DEBUG_PRINT
                 printf("root[%u][%u] = %u\n",i,j , level2[j]>>12);
                 #endif /*DEBUG_PRINT*/
@@ -161,15 +1734,143 @@ public:
             pagesToAdd -= j;
         }
         m_CurrentPagesUsed = pages;
-        return true;
+        // v eager rezimu dosly ramce, cela zmena se vrati
+        if (failed)
+            removePages(oldPages);
+        return !failed;
     }
 
+    /**
+     * Vezme ramec pro data, volajici uz ramec zabral v framePool.take.
+     * @return NO_FRAME, pokud ramec nejde ziskat ani nahradou stranek, zabrani pak resi volajici
+     */
+    uint32_t newFrame(bool zeroed = false){
+        uint32_t frame = m_Frames.pop(zeroed);
+        if (frame != NO_FRAME)
+            frameTable.set(frame, 1);
+        return frame;
+    }
+    /** Vrati ramec do m_Frames a uvolni ho v framePool. */
+    void freeFrame(uint32_t frame){
+        dropFrame(frame);
+        framePool.give(1);
+    }
+    /** Vrati volny ramec do m_Frames, pri zaniku procesu do m_Reclaim, zabrani v framePool resi volajici. */
+    void dropFrame(uint32_t frame){
+        if (m_Reclaim){
+            m_Reclaim[m_Reclaimed++] = frame;
+            m_Frames.m_pushed++;
+        } else
+            m_Frames.push(frame);
+    }
+    /**
+     * Polozka L2 tabulky pro novou stranku vpn, v lazy rezimu ramec zustane jen zabrany (pri prvnim pristupu je
+     * vynulovany). Volajici uz ramec zabral.
+     * @return polozka nebo 0, pokud ramec nejde ziskat
+     */
+    uint32_t newEntry(uint32_t vpn, bool write = true, bool zeroed = false){
+        if (g_Config.m_LazyAlloc){
+            m_LazyPages++;
+            return BIT_LAZY | BIT_USER | (write ? BIT_WRITE : 0);
+        }
+        uint32_t frame = newFrame(zeroed);
+        if (frame == NO_FRAME)
+            return 0;
+        frameTable.map(frame, this, vpn);
+        return (frame << OFFSET_BITS) | BIT_USER | (write ? BIT_WRITE : 0) | BIT_PRESENT;
+    }
+    /**
+     * Polozka nove stranky pro addPages a MemMap. Od prvniho ramce, ktery nejde ziskat, jsou dalsi stranky jen lazy,
+     * tabulky tak zustanou konzistentni a volajici celou zmenu vrati (lazy stranka vrati i sve zabrani).
+     * @param failed nastavi se pri prvnim nedostatku ramcu
+     */
+    uint32_t fillEntry(uint32_t vpn, bool write, bool zeroed, bool & failed){
+        uint32_t entry = failed ? 0 : newEntry(vpn, write, zeroed);
+        if (entry == 0){
+            failed = true;
+            m_LazyPages++;
+            entry = BIT_LAZY | BIT_USER | (write ? BIT_WRITE : 0);
+        }
+        return entry;
+    }
+    /**
+     * Uvolni obsah stranky s polozkou entry, ramec sdileny po forku se uvolni az s posledni referenci.
+     * @return 1 pokud se uvolnilo zabrani ramce v framePool, jinak 0
+     */
+    uint32_t releaseEntry(uint32_t entry){
+        if (entry & BIT_LAZY){
+            m_LazyPages--;
+            return 1;
+        }
+        if (entry & BIT_SWAP){
+            swapFile.free(entry >> OFFSET_BITS);
+            m_SwapPages--;
+            return 1;
+        }
+        if (entry & BIT_ZRAM){
+            freeZram(entry >> OFFSET_BITS);
+            m_ZramPages--;
+            return 1;
+        }
+        frameTable.unmap(entry >> OFFSET_BITS, this);
+        // slouceny ramec drzi zabrani slouceneho mapovani
+        uint32_t kept = frameTable.takeClaim(entry >> OFFSET_BITS) ? 1 : 0;
+        if (frameTable.put(entry >> OFFSET_BITS) > 0)
+            return kept;
+        dropFrame(entry >> OFFSET_BITS);
+        return kept + 1;
+    }
+    /** @return polozka L2 tabulky stranky vpn, jeji oblast uz tabulku ma */
+    uint32_t * tableEntry(uint32_t vpn){
+        return (uint32_t *) (m_MemStart + (m_RootPageAddr[vpn / PAGE_DIR_ENTRIES] & ADDR_MASK)) + vpn % PAGE_DIR_ENTRIES;
+    }
+
+    /**
+     * Rozdeli velkou stranku root tabulky i na obycejne stranky v L2 tabulce table, ramce behu se tim stanou
+     * obycejnymi ramci procesu. Pokud je table soucasti behu, jeho stranka v tabulce zustane prazdna.
+     */
+    void splitLarge(uint32_t i, uint32_t table){
+        uint32_t run = m_RootPageAddr[i] >> OFFSET_BITS;
+        largePool.split(run);
+        uint32_t bits = (m_RootPageAddr[i] & (BIT_REFERENCED | BIT_DIRTY)) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+        auto * level2 = (uint32_t *) (m_MemStart + (table << OFFSET_BITS));
+        for (uint32_t j = 0; j < PAGE_DIR_ENTRIES; j++){
+            if (run + j == table){
+                level2[j] = 0;
+                continue;
+            }
+            frameTable.set(run + j, 1);
+            frameTable.map(run + j, this, i * PAGE_DIR_ENTRIES + j);
+            level2[j] = ((run + j) << OFFSET_BITS) | bits;
+        }
+        m_RootPageAddr[i] = (table << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+        m_Tables++;
+        // TLB zaznamy oblasti ukazuji na polozku root tabulky
+        tlbFlush();
+    }
     bool removePages(uint32_t pages){
         uint32_t pagesToRemove =  m_CurrentPagesUsed - pages; // kolik stranek musim ubrat
+        uint32_t released = 0; // framePool se dozvi o uvolnenych ramcich najednou
+        tlbFlush();
         #ifdef DEBUG_PRINT
         printf("toARemove: %d\n", pagesToRemove);
         #endif /*DEBUG_PRINT*/
         for (uint32_t i = m_L2PagesUsed - 1; pagesToRemove > 0 ; i--) {
+            if (m_RootPageAddr[i] & BIT_LARGE){
+                if (pagesToRemove >= PAGE_DIR_ENTRIES){
+                    largePool.free(m_RootPageAddr[i] >> OFFSET_BITS);
+                    m_RootPageAddr[i] = 0;
+                    m_L2PagesUsed--;
+                    pagesToRemove -= PAGE_DIR_ENTRIES;
+                    m_CurrentPagesUsed -= PAGE_DIR_ENTRIES;
+                    continue;
+                }
+                // ramec posledni stranky oblasti se uvolnuje, poslouzi jako L2 tabulka pro zbytek
+                uint32_t table = (m_RootPageAddr[i] >> OFFSET_BITS) + PAGE_DIR_ENTRIES - 1;
+                splitLarge(i, table);
+                pagesToRemove--;
+                m_CurrentPagesUsed--;
+            }
             auto *level2 = (uint32_t *) (m_MemStart + (m_RootPageAddr[i] & ADDR_MASK));
             uint32_t pagesInLastL2 = m_CurrentPagesUsed % PAGE_DIR_ENTRIES;
             if (pagesInLastL2 == 0) pagesInLastL2 = PAGE_DIR_ENTRIES;
@@ -178,7 +1879,7 @@ public:
                 #ifdef DEBUG_PRINT
                 printf("root[%u][%u] = %u -> ",i,j-1,level2[j-1]>>12);
                 #endif /*DEBUG_PRINT*/
-                pageStack.push(level2[j-1] >> OFFSET_BITS);
+                released += releaseEntry(level2[j-1]);
                 level2[j-1] = 0;
                 #ifdef DEBUG_PRINT
                 printf("root[%u][%u] = %u\n",i,j-1,level2[j-1]>>12);
@@ -187,11 +1888,14 @@ public:
                 m_CurrentPagesUsed--;
             }
             if (j == 0){
-                pageStack.push(m_RootPageAddr[i] >> OFFSET_BITS);
+                dropFrame(m_RootPageAddr[i] >> OFFSET_BITS);
+                released++;
                 m_RootPageAddr[i] = 0;
                 m_L2PagesUsed--;
+                m_Tables--;
             }
         }
+        framePool.give(released);
         return true;
     }
     /**
@@ -204,45 +1908,1000 @@ public:
      * @return Úspěch true, neúspěch false.
      */
     virtual bool NewProcess(void *processArg, void (*entryPoint)(CCPU *, void *), bool copyMem){
-        pageStack.lock();
-        uint32_t rootTableAddress = ((pageStack.pop() << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT);
+        if (!framePool.take(1)){
+            return false;
+        }
+        tableLock();
+        uint32_t root = m_Frames.pop(true);
+        if (root == NO_FRAME){
+            tableUnlock();
+            framePool.give(1);
+            return false;
+        }
+        uint32_t rootTableAddress = ((root << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT);
 
         CMyCPU * cpu = new CMyCPU(m_MemStart, rootTableAddress);
 
-        if (copyMem){
-            if (!cpu->addPages(m_CurrentPagesUsed)){
-                delete cpu;
-                pageStack.unlock();
+        bool copied = !copyMem || copyTables(cpu);
+        tableUnlock();
+        if (!copied){
+            delete cpu;
+            return false;
+        }
+
+        cpu->m_Job.m_entry = entryPoint;
+        cpu->m_Job.m_cpu = cpu;
+        cpu->m_Job.m_arg = processArg;
+        if (!processPool.submit(&cpu->m_Job)){
+            delete cpu;
+            return false;
+        }
+        return true;
+    }
+    /**
+     * Vytvori sdileny segment, vynulovane ramce se vezmou hned. Segment nejde odlozit, musi se proto vejit do fyzicke
+     * pameti i se swapem (takePinned).
+     * @return id segmentu, 0 pri nedostatku pameti nebo volnych segmentu
+     */
+    virtual uint32_t ShmCreate(uint32_t pages){
+        if (pages == 0 || pages > s_TotalPages || !framePool.takePinned(pages))
+            return 0;
+        auto * frames = new uint32_t [pages];
+        for (uint32_t i = 0; i < pages; i++)
+            if ((frames[i] = m_Frames.pop(true)) == NO_FRAME){
+                while (i > 0)
+                    m_Frames.push(frames[--i]);
+                framePool.givePinned(pages);
+                delete[] frames;
+                return 0;
+            }
+        uint32_t id = shmTable.add(frames, pages);
+        if (id == 0)
+            freeSegment(frames, pages);
+        return id;
+    }
+    /** Namapuje ramce segmentu jako oblast od adresy address, podminky jsou stejne jako u MemMap. */
+    virtual bool ShmAttach(uint32_t id, uint32_t address){
+        uint32_t pages = 0, first = address >> OFFSET_BITS;
+        const uint32_t * frames = (address & ~ADDR_MASK) ? nullptr : shmTable.attach(id, pages, false);
+        if (!frames)
+            return false;
+        tableLock();
+        bool res = mapRegion({first, first + pages, id, true, 0, 0});
+        for (uint32_t i = 0; res && i < pages; i++)
+            *tableEntry(first + i) = (frames[i] << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+        tableUnlock();
+        if (!res){
+            uint32_t * freed = shmTable.detach(id, pages);
+            freeSegment(freed, pages);
+        }
+        return res;
+    }
+    /** Odpoji segment pripojeny na adrese address, L2 tabulky, ktere tim zustaly prazdne, se uvolni. */
+    virtual bool ShmDetach(uint32_t address){
+        tableLock();
+        const CRegionTree::TRegion * region = m_Regions.overlap(address >> OFFSET_BITS, (address >> OFFSET_BITS) + 1);
+        bool found = !(address & ~ADDR_MASK) && region && region->m_Shm && region->m_Start == address >> OFFSET_BITS;
+        if (found)
+            removeRegion(*region);
+        tableUnlock();
+        return found;
+    }
+    /** Segment zanikne s poslednim odpojenim, pripojit uz ho pak jde jen forkem. */
+    virtual bool ShmRemove(uint32_t id){
+        uint32_t * frames, pages = 0;
+        bool found = shmTable.remove(id, frames, pages);
+        freeSegment(frames, pages);
+        return found;
+    }
+    /**
+     * Namapuje anonymni oblast pages stranek od adresy address, stranky jsou vynulovane a jen pro cteni, pokud
+     * write neni nastaveno. Oblasti po 4 MiB, do kterych zasahuje, musi byt za limitem pameti (SetMemLimit do nich
+     * pak neroste), se zadnou jinou oblasti se nesmi prekryvat. L2 tabulky vznikaji jen pro takto pouzite oblasti.
+     */
+    virtual bool MemMap(uint32_t address, uint32_t pages, bool write){
+        uint32_t first = address >> OFFSET_BITS;
+        tableLock();
+        bool res = !(address & ~ADDR_MASK) && mapRegion({first, first + pages, 0, write, 0, 0}), failed = false;
+        for (uint32_t vpn = first; res && vpn < first + pages; vpn++)
+            *tableEntry(vpn) = fillEntry(vpn, write, true, failed);
+        if (res && failed){
+            removeRegion(*m_Regions.overlap(first, first + 1));
+            res = false;
+        }
+        tableUnlock();
+        return res;
+    }
+    /**
+     * Zrusi stranky [address, address + pages) anonymnich a souborovych oblasti, oblast zasazena jen zcasti se zkrati
+     * nebo rozdeli. Stranky mimo oblasti se preskoci, zasah do pripojeneho segmentu je chyba (odpojuje se cely).
+     * Zmenene stranky souboru se zapisou zpet, false i pri chybe zapisu (oblast se presto zrusi).
+     */
+    virtual bool MemUnmap(uint32_t address, uint32_t pages){
+        uint32_t start = address >> OFFSET_BITS, end = start + pages;
+        if ((address & ~ADDR_MASK) || pages > (1u << (32 - OFFSET_BITS)) - start)
+            return false;
+        tableLock();
+        bool res = true;
+        for (const CRegionTree::TRegion * r = m_Regions.overlap(start, end); r && res; r = m_Regions.overlap(r->m_End, end))
+            res = r->m_Shm == 0;
+        bool written = true;
+        for (const CRegionTree::TRegion * r; res && (r = m_Regions.overlap(start, end)); ){
+            CRegionTree::TRegion region = *r, rest = region;
+            m_Regions.erase(region.m_Start);
+            // zbytky pred a za rusenym rozsahem zustavaji, kazdy s vlastni referenci souboru
+            if (region.m_Start < start){
+                rest.m_End = start;
+                m_Regions.insert(rest);
+                if (region.m_File) fileTable.get(region.m_File);
+            }
+            if (region.m_End > end){
+                rest.m_Start = end;
+                rest.m_End = region.m_End;
+                rest.m_Offset = region.m_Offset + end - region.m_Start;
+                m_Regions.insert(rest);
+                if (region.m_File) fileTable.get(region.m_File);
+            }
+            written &= unmapPages(region, region.m_Start > start ? region.m_Start : start, region.m_End < end ? region.m_End : end);
+            if (region.m_File)
+                fileTable.put(region.m_File);
+        }
+        tableUnlock();
+        return res && written;
+    }
+    /**
+     * Namapuje soubor path od bajtu offset (zarovnany na stranku) jako oblast pages stranek od adresy address,
+     * umisteni je stejne jako u MemMap. Stranky jsou lazy i bez m_LazyAlloc, nacitaji se az pri vypadku
+     * (loadFile). Se zapisem (soubor se otevre i pro zapis) se zmenene stranky zapisuji zpet pri MemSync, MemUnmap,
+     * konci procesu a pri nahrade stranek, zmeny nekolika procesu se stejnym souborem nejsou koherentni.
+     */
+    virtual bool MapFile(uint32_t address, uint32_t pages, const char *path, uint32_t offset, bool write){
+        uint32_t first = address >> OFFSET_BITS, file;
+        if ((address & ~ADDR_MASK) || (offset & ~ADDR_MASK) || !(file = fileTable.open(path, write)))
+            return false;
+        tableLock();
+        bool res = mapRegion({first, first + pages, 0, write, file, offset >> OFFSET_BITS});
+        for (uint32_t vpn = first; res && vpn < first + pages; vpn++)
+            *tableEntry(vpn) = BIT_LAZY | BIT_USER | (write ? BIT_WRITE : 0);
+        if (res)
+            m_LazyPages += pages;
+        tableUnlock();
+        if (!res)
+            fileTable.put(file);
+        return res;
+    }
+    /** Zapise zmenene stranky souborovych oblasti v rozsahu zpet do souboru. */
+    virtual bool MemSync(uint32_t address, uint32_t pages){
+        uint32_t start = address >> OFFSET_BITS, end = start + pages;
+        if ((address & ~ADDR_MASK) || pages > (1u << (32 - OFFSET_BITS)) - start)
+            return false;
+        bool res = true;
+        tableLock();
+        for (const CRegionTree::TRegion * r = m_Regions.overlap(start, end); r; r = m_Regions.overlap(r->m_End, end))
+            for (uint32_t vpn = r->m_Start > start ? r->m_Start : start; r->m_File && vpn < r->m_End && vpn < end; vpn++)
+                res &= writeBack(*r, vpn);
+        tableUnlock();
+        return res;
+    }
+    /**
+     * Kopie adresniho prostoru pro fork, kopiruji se jen L2 tabulky, oblasti za limitem pameti podle stromu oblasti.
+     * Zapisovatelne stranky se v obou procesech oznaci jako copy-on-write a sdileny ramec dostane dalsi referenci,
+     * vlastni kopie vznikne az pri prvnim zapisu v pageFaultHandler. Stranky bez ramce (lazy) dostane potomek
+     * take bez ramce, ale s vlastnim zabranim ramce v framePool. Slot odlozene stranky (swap i zram) dostane dalsi
+     * referenci a kazdy proces si stranku nacte do vlastniho ramce. Pripojene segmenty potomek dedi na stejnych
+     * adresach, jejich ramce se nekopiruji ani neoznacuji. Volajici drzi zamek tabulek rodice.
+     * Ramce L2 tabulek se berou predem, cekani v pop muze menit tabulky rodice nahradou stranek, samotne kopirovani
+     * uz pak probehne pod zamkem tabulek potomka najednou.
+     * @param cpu nove vytvoreny proces
+     * @return false pokud nejsou ramce na L2 tabulky
+     */
+    bool copyTables(CMyCPU * cpu){
+        uint32_t frames[2 * PAGE_DIR_ENTRIES], count = 0;
+        for (uint32_t i = 0; i < PAGE_DIR_ENTRIES; i++)
+            if (m_RootPageAddr[i] != 0)
+                count += (m_RootPageAddr[i] & BIT_LARGE) ? 2 : 1;
+        if (!framePool.take(count))
+            return false;
+        for (uint32_t i = 0; i < count; i++)
+            if ((frames[i] = m_Frames.pop()) == NO_FRAME){
+                while (i > 0)
+                    m_Frames.push(frames[--i]);
+                framePool.give(count);
                 return false;
             }
-            for (uint32_t i = 0; i < m_L2PagesUsed; i++){
-                auto * level2old = (uint32_t *) (m_MemStart + (m_RootPageAddr[i] & ADDR_MASK));
-                auto * level2new = (uint32_t *) (m_MemStart + (cpu->m_RootPageAddr[i] & ADDR_MASK));
-                for (uint32_t j = 0; j < PAGE_DIR_ENTRIES; ++j) {
-                    auto * entryNew = (uint32_t *) (m_MemStart + (level2new[j] & ADDR_MASK));
-                    auto * entryOld = (uint32_t *) (m_MemStart + (level2old[j] & ADDR_MASK));
-                    memcpy(entryNew, entryOld, PAGE_SIZE);
-                }
+        if (!framePool.take(m_LazyPages + m_SwapPages + m_ZramPages)){
+            for (uint32_t i = 0; i < count; i++)
+                m_Frames.push(frames[i]);
+            framePool.give(count);
+            return false;
+        }
+        // velke stranky se pred sdilenim rozdeli, copy-on-write funguje po obycejnych strankach
+        for (uint32_t i = 0; i < m_L2PagesUsed; i++)
+            if (m_RootPageAddr[i] & BIT_LARGE)
+                splitLarge(i, frames[--count]);
+        cpu->tableLock();
+        cpu->m_LazyPages = m_LazyPages;
+        cpu->m_SwapPages = m_SwapPages;
+        cpu->m_ZramPages = m_ZramPages;
+        for (uint32_t i = 0, next = 0; i < PAGE_DIR_ENTRIES; i++){
+            if (m_RootPageAddr[i] == 0)
+                continue;
+            auto * level2old = (uint32_t *) (m_MemStart + (m_RootPageAddr[i] & ADDR_MASK));
+            cpu->m_RootPageAddr[i] = (frames[next++] << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+            cpu->m_Tables++;
+            auto * level2new = (uint32_t *) (m_MemStart + (cpu->m_RootPageAddr[i] & ADDR_MASK));
+            if (i >= m_L2PagesUsed){
+                memset(level2new, 0, PAGE_SIZE);
+                continue;
             }
+            for (uint32_t j = 0; j < PAGE_DIR_ENTRIES; ++j)
+                level2new[j] = shareEntry(level2old[j]);
         }
-        pageStack.unlock();
-
-        pthread_t detachedThread;
-        pthread_attr_t thrAttr;
-        pthread_attr_init ( &thrAttr );
-        pthread_attr_setdetachstate ( &thrAttr, PTHREAD_CREATE_DETACHED );
-        auto * args = new thread_args(entryPoint, cpu, processArg);
-        pthread_create(&detachedThread, &thrAttr, thread_args_wrapper, (void *)args);
-        pthread_attr_destroy ( &thrAttr );
+        for (const CRegionTree::TRegion * r = m_Regions.next(0); r; r = m_Regions.next(r->m_End)){
+            for (uint32_t vpn = r->m_Start; vpn < r->m_End; vpn++)
+                *cpu->tableEntry(vpn) = r->m_Shm ? *tableEntry(vpn) : shareEntry(*tableEntry(vpn));
+            cpu->m_Regions.insert(*r);
+            uint32_t pages;
+            if (r->m_Shm)
+                shmTable.attach(r->m_Shm, pages, true);
+            if (r->m_File)
+                fileTable.get(r->m_File);
+        }
+        cpu->m_L2PagesUsed = m_L2PagesUsed;
+        cpu->m_CurrentPagesUsed = m_CurrentPagesUsed;
+        cpu->m_RegionPages = m_RegionPages;
+        cpu->tableUnlock();
+        m_ForkBytes += (uint64_t) cpu->m_Tables * PAGE_SIZE;
+        // rodic uz nesmi zapisovat pres TLB do sdilenych ramcu
+        tlbFlush();
+        return true;
+    }
+    /**
+     * Sdileni stranky forkem: zapisovatelna stranka se oznaci jako copy-on-write, ramec nebo slot dostane dalsi
+     * referenci.
+     * @return polozka pro potomka
+     */
+    uint32_t shareEntry(uint32_t & entry){
+        if (entry & BIT_PRESENT){
+            entry = cowEntry(entry);
+            frameTable.get(entry >> OFFSET_BITS);
+        } else if (entry & BIT_SWAP)
+            swapFile.get(entry >> OFFSET_BITS);
+        else if (entry & BIT_ZRAM)
+            zram.get(entry >> OFFSET_BITS);
+        return entry;
+    }
+    /** @return pritomna polozka sdileneho ramce, zapisovatelna stranka je copy-on-write */
+    static uint32_t cowEntry(uint32_t entry){
+        return (entry & BIT_WRITE) ? (entry & ~BIT_WRITE) | BIT_COW : entry;
+    }
+    /** Vrati ramce zanikleho segmentu (nullptr = segment zije dal) do m_Frames a framePool. */
+    void freeSegment(uint32_t * frames, uint32_t pages){
+        if (!frames)
+            return;
+        for (uint32_t i = 0; i < pages; i++)
+            dropFrame(frames[i]);
+        framePool.givePinned(pages);
+        delete[] frames;
+    }
+    /**
+     * Zalozi oblast ve stromu a vytvori ji chybejici L2 tabulky, polozky stranek doplni volajici. Oblasti po 4 MiB,
+     * do kterych zasahuje, musi byt za limitem pameti a nesmi se prekryvat s jinou oblasti. Oblast, ktera neni
+     * segment, si zabere i ramce svych stranek. Volajici drzi zamek tabulek.
+     * @return false bez jakekoli zmeny, pokud oblast nejde zalozit
+     */
+    bool mapRegion(const CRegionTree::TRegion & region){
+        uint32_t first = region.m_Start, pages = region.m_End - region.m_Start;
+        if (pages == 0 || region.m_End > 1u << (32 - OFFSET_BITS) || region.m_End < first
+            || first / PAGE_DIR_ENTRIES < m_L2PagesUsed || m_Regions.overlap(first, first + pages))
+            return false;
+        uint32_t tables = 0;
+        for (uint32_t i = first / PAGE_DIR_ENTRIES; i <= (first + pages - 1) / PAGE_DIR_ENTRIES; i++)
+            if (m_RootPageAddr[i] == 0)
+                tables++;
+        if (!framePool.take(tables + (region.m_Shm ? 0 : pages)))
+            return false;
+        uint32_t frames[PAGE_DIR_ENTRIES];
+        for (uint32_t t = 0; t < tables; t++)
+            if ((frames[t] = m_Frames.pop(true)) == NO_FRAME){
+                while (t > 0)
+                    m_Frames.push(frames[--t]);
+                framePool.give(tables + (region.m_Shm ? 0 : pages));
+                return false;
+            }
+        for (uint32_t i = first / PAGE_DIR_ENTRIES, t = 0; i <= (first + pages - 1) / PAGE_DIR_ENTRIES; i++)
+            if (m_RootPageAddr[i] == 0)
+                m_RootPageAddr[i] = (frames[t++] << OFFSET_BITS) | BIT_USER | BIT_WRITE | BIT_PRESENT;
+        m_Regions.insert(region);
+        m_Tables += tables;
+        m_RegionPages += pages;
         return true;
     }
+    /**
+     * Zrusi polozky stranek [start, end) oblasti region, data stranek, ktere nejsou segment, se uvolni a zmenene
+     * stranky souboru se predtim zapisou zpet. L2 tabulky, ktere tim zustaly prazdne, se uvolni. Volajici drzi zamek
+     * tabulek.
+     * @return false pokud se nektera stranka nezapsala do souboru
+     */
+    bool unmapPages(const CRegionTree::TRegion & region, uint32_t start, uint32_t end){
+        uint32_t released = 0;
+        bool written = true;
+        tlbFlush();
+        for (uint32_t vpn = start; vpn < end; vpn++){
+            uint32_t * entry = tableEntry(vpn);
+            if (region.m_File)
+                written &= writeBack(region, vpn);
+            if (!region.m_Shm)
+                released += releaseEntry(*entry);
+            *entry = 0;
+            if ((vpn + 1) % PAGE_DIR_ENTRIES != 0 && vpn + 1 != end)
+                continue;
+            // konec oblasti po 4 MiB, tabulka muze patrit i dalsim oblastem
+            uint32_t * level2 = entry - vpn % PAGE_DIR_ENTRIES, j = 0;
+            while (j < PAGE_DIR_ENTRIES && level2[j] == 0)
+                j++;
+            if (j == PAGE_DIR_ENTRIES){
+                dropFrame(m_RootPageAddr[vpn / PAGE_DIR_ENTRIES] >> OFFSET_BITS);
+                m_RootPageAddr[vpn / PAGE_DIR_ENTRIES] = 0;
+                m_Tables--;
+                released++;
+            }
+        }
+        m_RegionPages -= end - start;
+        framePool.give(released);
+        return written;
+    }
+    /** Zrusi celou oblast, segment se odpoji, soubor se zavre s posledni oblasti. Volajici drzi zamek tabulek. */
+    void removeRegion(CRegionTree::TRegion region){
+        m_Regions.erase(region.m_Start);
+        unmapPages(region, region.m_Start, region.m_End);
+        if (region.m_File)
+            fileTable.put(region.m_File);
+        if (region.m_Shm){
+            uint32_t pages = 0;
+            uint32_t * freed = shmTable.detach(region.m_Shm, pages);
+            freeSegment(freed, pages);
+        }
+    }
+    /**
+     * Zapise stranku vpn souborove oblasti zpet, pokud je namapovana a zmenena. BIT_DIRTY se smaze a stranka zmizi
+     * z TLB, aby dalsi zapis bit znovu nastavil. Stranka, ktera se do souboru cela nevejde, BIT_DIRTY necha, aby ji
+     * nahrada stranek nezahodila. Volajici drzi zamek tabulek.
+     */
+    bool writeBack(const CRegionTree::TRegion & region, uint32_t vpn){
+        uint32_t * entry = tableEntry(vpn);
+        if ((*entry & (BIT_PRESENT | BIT_DIRTY)) != (BIT_PRESENT | BIT_DIRTY))
+            return true;
+        if (!fileTable.write(region.m_File, region.m_Offset + vpn - region.m_Start, m_MemStart + (*entry & ADDR_MASK)))
+            return false;
+        if (!fileTable.whole(region.m_File, region.m_Offset + vpn - region.m_Start))
+            return true;
+        *entry &= ~BIT_DIRTY;
+        tlbFlushPage(vpn << OFFSET_BITS);
+        return true;
+    }
+    /**
+     * Vypadek lazy stranky vpn souborove oblasti: nacte ji ze souboru jednim ctenim spolu s nasledujicimi lazy
+     * strankami oblasti (readahead). Vypadek, ktery navazuje na predchozi cteni, okno zdvojnasobi az do READAHEAD,
+     * jiny ho vrati na READAHEAD_MIN. Ramce uz jsou zabrane lazy polozkami.
+     */
+    bool loadFile(const CRegionTree::TRegion & region, uint32_t vpn){
+        uint32_t frames[READAHEAD], count = 0;
+        if (vpn != m_RaNext)
+            m_RaWindow = READAHEAD_MIN;
+        else if (m_RaWindow < READAHEAD)
+            m_RaWindow *= 2;
+        // readahead skonci u ramce, ktery nejde ziskat, bez ramce pro samotnou stranku vypadek selze
+        while (count < m_RaWindow && vpn + count < region.m_End && (*tableEntry(vpn + count) & BIT_LAZY)
+               && (frames[count] = newFrame()) != NO_FRAME)
+            count++;
+        if (count == 0)
+            return false;
+        if (!fileTable.read(region.m_File, region.m_Offset + vpn - region.m_Start, m_MemStart, frames, count)){
+            for (uint32_t i = 0; i < count; i++){
+                frameTable.set(frames[i], 0);
+                m_Frames.push(frames[i]);
+            }
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++){
+            uint32_t * entry = tableEntry(vpn + i);
+            frameTable.map(frames[i], this, vpn + i);
+            *entry = (frames[i] << OFFSET_BITS) | (*entry & BIT_WRITE) | BIT_USER | BIT_PRESENT;
+        }
+        m_LazyPages -= count;
+        m_RaNext = vpn + count;
+        return true;
+    }
+    static const uint32_t READAHEAD = 32;
+    static const uint32_t READAHEAD_MIN = 4;
+public:
+    /**
+     * Nahrada stranek algoritmem hodin (second chance) nad ramci s referenci ve frameTable.
+     * Ramec, jehoz procesy nejdou zpristupnit (lockMappers), se preskoci.
+     * Volajici behem pruchodu pusti vsechna vnoreni zamku svych tabulek, jinak by se cekajici procesy se sdilenymi
+     * ramci navzajem zablokovaly. Jeho tabulky jsou v pop konzistentni a muze tak prijit i o vlastni stranku,
+     * po navratu zamek znovu vezme.
+     * @param waiter proces, ktery v pop ceka na ramec
+     * @param busy nastavi se, pokud se nektery ramec preskocil, protoze jeho proces prave pouzival tabulky, nebo
+     *             ho pri druhe navsteve v tomto pruchodu znovu pouzil, dalsi pruchod tedy muze uspet
+     * @return uvolneny ramec, uz zabrany volajicim, nebo NO_FRAME
+     */
+    static uint32_t evictFrame(CMyCPU * waiter, bool & busy){
+        uint32_t found = NO_FRAME, depth = waiter->m_TableDepth;
+        CMyCPU * mappers[EVICT_MAPPERS];
+        for (uint32_t i = 0; i < depth; i++)
+            waiter->tableUnlock();
+        pthread_mutex_lock(&s_EvictMtx);
+        for (uint32_t n = 0; n < 2 * s_TotalPages && found == NO_FRAME; n++){
+            uint32_t frame = s_ClockHand, vpn;
+            s_ClockHand = (s_ClockHand + 1) % s_TotalPages;
+            bool used = false;
+            uint32_t count = lockMappers(frame, vpn, mappers, &busy);
+            if (count > 0 && evictPage(frame, vpn, mappers, count, used))
+                found = frame;
+            // kazdy ramec se navstivi dvakrat, pri prvni navsteve se BIT_REFERENCED smazal
+            if (used && n >= s_TotalPages)
+                busy = true;
+            unlockMappers(mappers, count);
+        }
+        pthread_mutex_unlock(&s_EvictMtx);
+        for (uint32_t i = 0; i < depth; i++)
+            waiter->tableLock();
+        return found;
+    }
+    /**
+     * Kompakce: sestavi volny blok MAX_ORDER presunem obsazenych ramcu jednoho bloku jinam.
+     * Vybere blok s nejvice volnymi ramci, jehoz obsazene ramce jsou vsechny datove (tabulky, uloziste zram, velke
+     * stranky, sdilene segmenty a ramce v pohybu nemaji reference). Volne ramce bloku se vyjmou z framePool, kazdy obsazeny se
+     * zkopiruje do noveho ramce mimo blok a polozky vsech procesu, ktere ho mapuji, se prepisou. Kdyz nektery ramec
+     * presunout nejde, zbytek bloku se vrati do framePool, uz presunute ramce zustanou na novem miste.
+     * @return prvni ramec bloku, uz mimo framePool, nebo NO_FRAME
+     */
+    static uint32_t compactRun(){
+        uint32_t best = NO_FRAME, bestFree = 0;
+        auto * free = new uint8_t [s_TotalPages];
+        CFrameCache::drainAll();
+        pthread_mutex_lock(&s_EvictMtx);
+        framePool.freeMap(free);
+        // presunute ramce musi mit misto v dirach jinych bloku, jinak by se rozbil uz volny blok a kompakce by
+        // jen prelevala ramce mezi dvema bloky
+        uint32_t holes = 0;
+        for (uint32_t first = 0; first < s_TotalPages; first += CLargePool::RUN){
+            uint32_t freeCount = 0, last = first + CLargePool::RUN < s_TotalPages ? first + CLargePool::RUN : s_TotalPages;
+            for (uint32_t frame = first; frame < last; frame++)
+                freeCount += free[frame];
+            if (freeCount < CLargePool::RUN)
+                holes += freeCount;
+        }
+        if (holes >= CLargePool::RUN)
+            for (uint32_t first = 0; first + CLargePool::RUN <= s_TotalPages; first += CLargePool::RUN){
+                uint32_t freeCount = 0;
+                bool movable = true;
+                for (uint32_t frame = first; frame < first + CLargePool::RUN && movable; frame++)
+                    if (free[frame])
+                        freeCount++;
+                    else
+                        movable = frameTable.refs(frame) > 0 && frameTable.refs(frame) <= EVICT_MAPPERS;
+                if (movable && freeCount > bestFree && freeCount < CLargePool::RUN){
+                    best = first;
+                    bestFree = freeCount;
+                }
+            }
+        delete[] free;
+        bool done = best != NO_FRAME;
+        if (done){
+            framePool.isolate(best);
+            for (uint32_t frame = best; frame < best + CLargePool::RUN && done; frame++)
+                if (!framePool.isolated(frame))
+                    done = migrate(frame);
+            framePool.release(best, done);
+        }
+        #ifdef DEBUG_PRINT
+        printf("compaction: block %u%s\n", best, done ? "" : " failed");
+        #endif /*DEBUG_PRINT*/
+        pthread_mutex_unlock(&s_EvictMtx);
+        return done ? best : NO_FRAME;
+    }
+    /**
+     * Slucovani stejnych stranek pro vlakno mergeScanner, jeden ramec za volani.
+     * Kandidatem je datovy ramec namapovany jedinym procesem mimo souborovou oblast, jehoz obsah se od minule
+     * navstevy nezmenil. Stejny uz slouceny ramec ze stable tabulky dostane dalsi mapovani, jinak se stejny kandidat
+     * tohoto pruchodu z unstable tabulky stane sloucenym ramcem. Obe polozky jsou pak copy-on-write, zapis je rozdeli
+     * v pageFaultHandler, a ramec stranky se vrati do framePool, jeho zabrani si ponecha slouceny ramec (mergePage),
+     * takze zapis ma pro kopii ramec vzdy zajisteny. Slouceny ramec se muze mapovat na
+     * ruznych strankach ruznych procesu, lockMappers ho proto nenajde a odkladani ani kompakce na nej nesahaji.
+     */
+    static void mergeFrame(uint32_t frame){
+        CMyCPU * mappers[EVICT_MAPPERS], * others[EVICT_MAPPERS];
+        uint32_t vpn, otherVpn, count = 0, otherCount = 0;
+        pthread_mutex_lock(&s_EvictMtx);
+        if (frameTable.refs(frame) == 1)
+            count = lockMappers(frame, vpn, mappers);
+        uint32_t * entry = count > 0 ? mappers[0]->pageEntry(vpn, frame) : nullptr;
+        if (entry && !mappers[0]->fileRegion(vpn)){
+            uint32_t sum = mergeScanner.checksum(frame), target = NO_FRAME;
+            bool steady = mergeScanner.steady(frame, sum);
+            if (steady && (target = mergeScanner.findStable(sum, frame)) != NO_FRAME)
+                mappers[0]->mergePage(entry, vpn, frame, target);
+            else if (steady && (target = mergeScanner.findUnstable(sum, frame)) != NO_FRAME
+                     && frameTable.refs(target) == 1 && (otherCount = lockMappers(target, otherVpn, others)) > 0){
+                uint32_t * other = others[0]->pageEntry(otherVpn, target);
+                if (other && !others[0]->fileRegion(otherVpn) && mergeScanner.same(frame, target)){
+                    *other = cowEntry(*other);
+                    others[0]->tlbFlushPage(otherVpn << OFFSET_BITS);
+                    frameTable.unmap(target, others[0]);
+                    frameTable.set(target, 2);
+                    mappers[0]->mergePage(entry, vpn, frame, target);
+                    mergeScanner.addStable(sum, target);
+                }
+            }
+        }
+        unlockMappers(others, otherCount);
+        unlockMappers(mappers, count);
+        pthread_mutex_unlock(&s_EvictMtx);
+    }
+    /**
+     * Snimek statistik pro MemMgrStats: zijici procesy podle s_Processes, k soucetnim citacum se pricte s_Exited.
+     * Citace se ctou bez zamku tabulek, snimek tedy nemusi byt mezi procesy presne konzistentni.
+     */
+    static uint32_t stats(TMemStats & stats, TMemProcStats * procs, uint32_t max){
+        memset(&stats, 0, sizeof(stats));
+        uint32_t count = 0;
+        pthread_mutex_lock(&s_EvictMtx);
+        for (CMyCPU * cpu = s_Processes; cpu; cpu = cpu->m_Next, count++){
+            TMemProcStats proc;
+            cpu->snapshot(proc);
+            addCounters(stats.m_Total, proc);
+            stats.m_Total.m_Limit += proc.m_Limit;
+            stats.m_Total.m_Mapped += proc.m_Mapped;
+            stats.m_Total.m_Resident += proc.m_Resident;
+            stats.m_Total.m_Reserved += proc.m_Reserved;
+            stats.m_Total.m_Swapped += proc.m_Swapped;
+            stats.m_Total.m_Compressed += proc.m_Compressed;
+            stats.m_Total.m_Tables += proc.m_Tables;
+            if (count < max)
+                procs[count] = proc;
+        }
+        addCounters(stats.m_Total, s_Exited);
+        stats.m_Processes = count;
+        stats.m_Created = s_Created;
+        pthread_mutex_unlock(&s_EvictMtx);
+        stats.m_FreeFrames = framePool.available();
+        framePool.lockStats(stats.m_PoolWaits, stats.m_PoolWaitNs);
+        return count;
+    }
+    /** Zacatek MemMgr, statistiky predchoziho behu se zahodi. */
+    static void resetStats(){
+        s_Created = 0;
+        memset(&s_Exited, 0, sizeof(s_Exited));
+    }
+private:
+    void snapshot(TMemProcStats & stats){
+        stats.m_Pid = m_Pid;
+        stats.m_Limit = m_CurrentPagesUsed;
+        stats.m_Mapped = stats.m_Limit + m_RegionPages;
+        stats.m_Reserved = m_LazyPages;
+        stats.m_Swapped = m_SwapPages;
+        stats.m_Compressed = m_ZramPages;
+        stats.m_Resident = stats.m_Mapped - stats.m_Reserved - stats.m_Swapped - stats.m_Compressed;
+        stats.m_Tables = m_Tables;
+        stats.m_LazyFaults = m_LazyFaults;
+        stats.m_FileFaults = m_FileFaults;
+        stats.m_SwapFaults = m_SwapFaults;
+        stats.m_ZramFaults = m_ZramFaults;
+        stats.m_CowFaults = m_CowFaults;
+        stats.m_FramesAllocated = m_Frames.m_popped;
+        stats.m_FramesFreed = m_Frames.m_pushed;
+        stats.m_ForkBytes = m_ForkBytes;
+    }
+    /** Pricte citace udalosti z from. */
+    static void addCounters(TMemProcStats & to, const TMemProcStats & from){
+        to.m_LazyFaults += from.m_LazyFaults;
+        to.m_FileFaults += from.m_FileFaults;
+        to.m_SwapFaults += from.m_SwapFaults;
+        to.m_ZramFaults += from.m_ZramFaults;
+        to.m_CowFaults += from.m_CowFaults;
+        to.m_FramesAllocated += from.m_FramesAllocated;
+        to.m_FramesFreed += from.m_FramesFreed;
+        to.m_ForkBytes += from.m_ForkBytes;
+    }
+    /**
+     * Zpristupni tabulky vsech procesu, ktere maji ramec namapovany, volajici drzi s_EvictMtx.
+     * Nesdileny ramec ma vlastnika v reverse map, ramec sdileny po forku (nebo ten, jehoz vlastnik uz si udelal kopii)
+     * se hleda v tabulkach vsech procesu na stejne strance, po forku je vsude na stejne adrese.
+     * @param vpn stranka, na ktere je ramec namapovany
+     * @param busy nastavi se, pokud nektery proces nesel zamknout
+     * @return pocet procesu v mappers, 0 pokud nektery proces nejde zamknout nebo nesouhlasi pocet namapovani
+     */
+    static uint32_t lockMappers(uint32_t frame, uint32_t & vpn, CMyCPU ** mappers, bool * busy = nullptr){
+        uint32_t refs = frameTable.refs(frame), count = 0;
+        vpn = frameTable.vpn(frame);
+        if (refs == 0 || refs > EVICT_MAPPERS)
+            return 0;
+        CMyCPU * owner = frameTable.owner(frame);
+        bool usable = true;
+        if (refs == 1 && owner){
+            usable = owner->evictLock();
+            if (usable)
+                mappers[count++] = owner;
+        } else
+            for (CMyCPU * cpu = s_Processes; cpu && usable && count < refs; cpu = cpu->m_Next){
+                usable = cpu->evictLock();
+                if (usable && cpu->pageEntry(vpn, frame))
+                    mappers[count++] = cpu;
+                else if (usable)
+                    pthread_mutex_unlock(&cpu->m_TableMutex);
+            }
+        // s pristupem ke vsem tabulkam se pocet referenci uz zmenit nemuze
+        if (usable && count == refs && frameTable.refs(frame) == refs)
+            return count;
+        if (!usable && busy)
+            *busy = true;
+        unlockMappers(mappers, count);
+        return 0;
+    }
+    static void unlockMappers(CMyCPU ** mappers, uint32_t count){
+        for (uint32_t i = 0; i < count; i++)
+            pthread_mutex_unlock(&mappers[i]->m_TableMutex);
+    }
+    /** Presune obsazeny ramec bloku kompakce do noveho ramce, volajici drzi s_EvictMtx. */
+    static bool migrate(uint32_t frame){
+        CMyCPU * mappers[EVICT_MAPPERS];
+        uint32_t vpn, count = lockMappers(frame, vpn, mappers), to = NO_FRAME;
+        if (count > 0 && (to = framePool.allocBlock(0)) != NO_FRAME){
+            CMyCPU * owner = frameTable.owner(frame);
+            memcpy(mappers[0]->m_MemStart + (to << OFFSET_BITS), mappers[0]->m_MemStart + (frame << OFFSET_BITS), PAGE_SIZE);
+            for (uint32_t i = 0; i < count; i++){
+                uint32_t * entry = mappers[i]->pageEntry(vpn, frame);
+                *entry = (to << OFFSET_BITS) | (*entry & ~ADDR_MASK);
+                mappers[i]->tlbFlushPage(vpn << OFFSET_BITS);
+            }
+            frameTable.set(to, count);
+            frameTable.map(to, owner, vpn);
+            frameTable.unmap(frame, owner);
+            frameTable.set(frame, 0);
+            framePool.addIsolated(frame);
+        }
+        unlockMappers(mappers, count);
+        return to != NO_FRAME;
+    }
+    /**
+     * Premapuje stranku vpn z ramce frame na slouceny ramec target, referenci uz ma, frame se uvolni. Zabrani ramce
+     * v framePool si ponecha target, aby pozdejsi copy-on-write nemusel zabirat znovu.
+     */
+    void mergePage(uint32_t * entry, uint32_t vpn, uint32_t frame, uint32_t target){
+        *entry = (target << OFFSET_BITS) | (cowEntry(*entry) & ~ADDR_MASK);
+        tlbFlushPage(vpn << OFFSET_BITS);
+        frameTable.unmap(frame, this);
+        frameTable.set(frame, 0);
+        framePool.pushBatch(&frame, 1);
+        frameTable.addClaim(target);
+        mergeScanner.merged();
+    }
+    /** @return stranka vpn patri do oblasti namapovaneho souboru */
+    bool fileRegion(uint32_t vpn){
+        const CRegionTree::TRegion * region = m_Regions.overlap(vpn, vpn + 1);
+        return region && region->m_File;
+    }
+    /**
+     * Pristup k tabulkam pro evictFrame, volajici drzi s_EvictMtx.
+     * @return false pokud tabulky prave pouziva jine vlakno, jinak je zamek vzaty a volajici ho pusti (unlockMappers)
+     */
+    bool evictLock(){
+        return pthread_mutex_trylock(&m_TableMutex) == 0;
+    }
+    /** @return polozka L2 tabulky stranky vpn, pokud je na ni namapovany ramec frame, jinak nullptr */
+    uint32_t * pageEntry(uint32_t vpn, uint32_t frame){
+        if ((m_RootPageAddr[vpn / PAGE_DIR_ENTRIES] & (BIT_PRESENT | BIT_LARGE)) != BIT_PRESENT)
+            return nullptr;
+        auto * level2 = (uint32_t *) (m_MemStart + (m_RootPageAddr[vpn / PAGE_DIR_ENTRIES] & ADDR_MASK));
+        uint32_t * entry = level2 + vpn % PAGE_DIR_ENTRIES;
+        if (!(*entry & BIT_PRESENT) || (*entry >> OFFSET_BITS) != frame)
+            return nullptr;
+        return entry;
+    }
+    /**
+     * Jeden krok hodin nad ramcem namapovanym ve vsech mappers, volajici drzi s_EvictMtx a jejich zamky tabulek.
+     * Ramec s BIT_REFERENCED v nektere polozce dostane dalsi sanci, bit se smaze a stranka zmizi z TLB, aby ho dalsi
+     * pristup znovu nastavil. Stranka, ktera nema BIT_DIRTY nikde, se od namapovani nezmenila a vrati se do lazy
+     * stavu bez zapisu, ostatni se jednou zkomprimuji do zram, a co se nezkomprimuje, zapise se do swapFile.
+     * Zmenena stranka souborove oblasti se zapise zpet do souboru a lazy stranka se z nej pak znovu nacte. Stranka
+     * za koncem souboru nebo pres nej se do souboru cela nevejde, odlozi se proto jako anonymni.
+     * Sdileny slot ma referenci za kazdou polozku. Kazda polozka pak v framePool drzi jeden ramec pro nacteni
+     * zpet, za sdileny ramec jich tedy musi pribyt count - 1, bez tech, ktera si ramec ponechal pri slouceni.
+     * @param used nastavi se, pokud stranka dostala dalsi sanci nebo jeji ramec se stal ulozistem zram
+     */
+    static bool evictPage(uint32_t frame, uint32_t vpn, CMyCPU ** mappers, uint32_t count, bool & used){
+        uint32_t * entries[EVICT_MAPPERS], any = 0;
+        for (uint32_t i = 0; i < count; i++){
+            entries[i] = mappers[i]->pageEntry(vpn, frame);
+            mappers[i]->tlbFlushPage(vpn << OFFSET_BITS);
+            any |= *entries[i];
+        }
+        if (any & BIT_REFERENCED){
+            for (uint32_t i = 0; i < count; i++)
+                *entries[i] &= ~BIT_REFERENCED;
+            used = true;
+            return false;
+        }
+        // slouceny ramec uz nektera zabrani drzi
+        uint32_t need = count - 1 - frameTable.claims(frame);
+        if (!framePool.take(need))
+            return false;
+        uint32_t slot = NO_FRAME, type = BIT_LAZY;
+        bool consumed = false; // ramec se stal ulozistem zram
+        const CRegionTree::TRegion * region = mappers[0]->m_Regions.overlap(vpn, vpn + 1);
+        bool file = region && region->m_File;
+        if ((any & BIT_DIRTY) && file && !fileTable.write(region->m_File, region->m_Offset + vpn - region->m_Start,
+                                                          mappers[0]->m_MemStart + (frame << OFFSET_BITS))){
+            framePool.give(need);
+            return false;
+        }
+        if ((any & BIT_DIRTY) && !(file && fileTable.whole(region->m_File, region->m_Offset + vpn - region->m_Start))){
+            if (zram.enabled() && (slot = zram.store(frame, count, consumed)) != NO_FRAME)
+                type = BIT_ZRAM;
+            else if ((slot = swapFile.alloc()) != NO_FRAME
+                     && swapFile.write(slot, mappers[0]->m_MemStart + (frame << OFFSET_BITS))){
+                type = BIT_SWAP;
+                for (uint32_t i = 1; i < count; i++)
+                    swapFile.get(slot);
+            } else {
+                if (slot != NO_FRAME)
+                    swapFile.free(slot);
+                framePool.give(need);
+                return false;
+            }
+        }
+        for (uint32_t i = 0; i < count; i++){
+            CMyCPU * cpu = mappers[i];
+            if (type == BIT_LAZY){
+                // stranka jen pro cteni zustava jen pro cteni, copy-on-write uz neni potreba
+                *entries[i] = BIT_LAZY | BIT_USER | ((*entries[i] & (BIT_WRITE | BIT_COW)) ? BIT_WRITE : 0);
+                cpu->m_LazyPages++;
+            } else {
+                *entries[i] = (slot << OFFSET_BITS) | (*entries[i] & (BIT_USER | BIT_WRITE | BIT_COW)) | type;
+                (type == BIT_ZRAM ? cpu->m_ZramPages : cpu->m_SwapPages)++;
+            }
+            frameTable.unmap(frame, cpu);
+        }
+        frameTable.set(frame, 0);
+        #ifdef DEBUG_PRINT
+        printf("evict: page %u, frame %u, %u mappers%s\n", vpn, frame, count, consumed ? " (zram store)" : "");
+        #endif /*DEBUG_PRINT*/
+        used = consumed;
+        return !consumed;
+    }
+    static pthread_mutex_t s_EvictMtx; // jeden evictFrame najednou, chrani rucicku hodin a zanikajici procesy
+    static uint32_t s_ClockHand;
+    static CMyCPU * s_Processes; // vsechny zijici procesy pro hledani sdilenych ramcu, chraneno s_EvictMtx
+    static uint32_t s_Created; // pocet procesu od startu MemMgr, chraneno s_EvictMtx
+    static TMemProcStats s_Exited; // citace udalosti skoncenych procesu, chraneno s_EvictMtx
+    /** Ramce sdilene vic procesy se neodkladaji. */
+    static const uint32_t EVICT_MAPPERS = 32;
+    CMyCPU * m_Next = nullptr;
+    CMyCPU * m_Prev = nullptr;
+public:
+    static uint32_t s_TotalPages;
 protected:
-    /*
-     if copy-on-write is implemented:
-     virtual bool pageFaultHandler ( uint32_t address, bool write );
+    /** Software bit, stranka je sdilena po forku a pred zapisem se musi zkopirovat. */
+    static const uint32_t BIT_COW = 0x0200;
+    /** Software bit v nepritomne polozce, stranka ma rezervovany ramec, ktery se prideli pri prvnim pristupu. */
+    static const uint32_t BIT_LAZY = 0x0400;
+    /** Software bit v nepritomne polozce, obsah stranky je ve swapFile ve slotu v bitech adresy. */
+    static const uint32_t BIT_SWAP = 0x0800;
+    /** Software bit v nepritomne polozce, stranka je zkomprimovana v zram ve slotu v bitech adresy. */
+    static const uint32_t BIT_ZRAM = 0x0100;
+    /** Uvolni slot zram, ramec uloziste, ktery tim zustal prazdny, jde do m_Frames (v framePool nebyl zabrany). */
+    void freeZram(uint32_t slot){
+        uint32_t emptied = zram.free(slot);
+        if (emptied != NO_FRAME)
+            dropFrame(emptied);
+    }
+    /**
+     * Obsluha vypadku stranky, resi prvni pristup k lazy strance, odlozenou stranku a zapis do copy-on-write stranky.
+     * Lazy stranka dostane vynulovany ramec ze sve rezervace, odlozena stranka se nacte ze zram nebo swapFile
+     * a slot se uvolni.
+     * Posledni vlastnik ramce jen vrati pravo zapisu, ostatni si udelaji vlastni kopii a sdileny ramec pusti.
+     * @return true pokud byl vypadek vyresen a pristup se ma zopakovat
      */
+    virtual bool pageFaultHandler(uint32_t address, bool write){
+        if ((m_RootPageAddr[address >> 22] & (BIT_PRESENT | BIT_LARGE)) != BIT_PRESENT)
+            return false;
+        auto * level2 = (uint32_t *) (m_MemStart + (m_RootPageAddr[address >> 22] & ADDR_MASK));
+        uint32_t * entry = level2 + ((address >> OFFSET_BITS) & (PAGE_DIR_ENTRIES - 1));
+        if (*entry & BIT_LAZY){
+            const CRegionTree::TRegion * region = m_Regions.overlap(address >> OFFSET_BITS, (address >> OFFSET_BITS) + 1);
+            if (region && region->m_File){
+                m_FileFaults++;
+                return loadFile(*region, address >> OFFSET_BITS);
+            }
+            m_LazyFaults++;
+            uint32_t frame = newFrame(true);
+            if (frame == NO_FRAME)
+                return false;
+            frameTable.map(frame, this, address >> OFFSET_BITS);
+            *entry = (frame << OFFSET_BITS) | (*entry & BIT_WRITE) | BIT_USER | BIT_PRESENT;
+            m_LazyPages--;
+            return true;
+        }
+        if (*entry & BIT_ZRAM){
+            m_ZramFaults++;
+            uint32_t frame = newFrame();
+            if (frame == NO_FRAME)
+                return false;
+            zram.load(*entry >> OFFSET_BITS, m_MemStart + (frame << OFFSET_BITS));
+            freeZram(*entry >> OFFSET_BITS);
+            frameTable.map(frame, this, address >> OFFSET_BITS);
+            *entry = (frame << OFFSET_BITS) | (*entry & (BIT_USER | BIT_WRITE | BIT_COW)) | BIT_PRESENT | BIT_DIRTY;
+            m_ZramPages--;
+            return true;
+        }
+        if (*entry & BIT_SWAP){
+            m_SwapFaults++;
+            uint32_t frame = newFrame();
+            if (frame == NO_FRAME)
+                return false;
+            if (!swapFile.read(*entry >> OFFSET_BITS, m_MemStart + (frame << OFFSET_BITS))){
+                // stranka zustava ve swapu i se svym zabranim v framePool
+                frameTable.set(frame, 0);
+                m_Frames.push(frame);
+                return false;
+            }
+            swapFile.free(*entry >> OFFSET_BITS);
+            frameTable.map(frame, this, address >> OFFSET_BITS);
+            // dirty zustava, kopie ve swapu uz neexistuje
+            *entry = (frame << OFFSET_BITS) | (*entry & (BIT_USER | BIT_WRITE | BIT_COW)) | BIT_PRESENT | BIT_DIRTY;
+            m_SwapPages--;
+            return true;
+        }
+        if (!write || (*entry & (BIT_PRESENT | BIT_COW)) != (BIT_PRESENT | BIT_COW))
+            return false;
+        uint32_t frame = *entry >> OFFSET_BITS;
+        tlbFlushPage(address);
+        m_CowFaults++;
+        if (frameTable.refs(frame) == 1){
+            frameTable.map(frame, this, address >> OFFSET_BITS);
+            *entry = (*entry & ~BIT_COW) | BIT_WRITE;
+            return true;
+        }
+        // kopie slouceneho ramce pouzije zabrani, ktere ramec pri slouceni ponechal
+        if (!frameTable.takeClaim(frame) && !framePool.take(1))
+            return false;
+        uint32_t copy = newFrame();
+        if (copy == NO_FRAME){
+            framePool.give(1);
+            return false;
+        }
+        if ((*entry & (BIT_PRESENT | BIT_COW)) != (BIT_PRESENT | BIT_COW) || (*entry >> OFFSET_BITS) != frame){
+            // sdileny ramec mezitim odlozila nahrada stranek, pristup se zopakuje a stranka se nacte zpet
+            frameTable.set(copy, 0);
+            freeFrame(copy);
+            return true;
+        }
+        memcpy(m_MemStart + (copy << OFFSET_BITS), m_MemStart + (frame << OFFSET_BITS), PAGE_SIZE);
+        frameTable.map(copy, this, address >> OFFSET_BITS);
+        *entry = (copy << OFFSET_BITS) | (*entry & ~ADDR_MASK & ~BIT_COW) | BIT_WRITE;
+        frameTable.unmap(frame, this);
+        if (frameTable.put(frame) == 0)
+            freeFrame(frame);
+        #ifdef DEBUG_PRINT
+        printf("cow: page %u, frame %u -> %u\n", address >> OFFSET_BITS, frame, copy);
+        #endif /*DEBUG_PRINT*/
+        return true;
+    }
 };
+pthread_mutex_t CMyCPU::s_EvictMtx = PTHREAD_MUTEX_INITIALIZER;
+uint32_t CMyCPU::s_ClockHand = 0;
+CMyCPU * CMyCPU::s_Processes = nullptr;
+uint32_t CMyCPU::s_Created = 0;
+TMemProcStats CMyCPU::s_Exited;
+uint32_t CMyCPU::s_TotalPages = 0;
+
+static uint32_t evictFrame(CMyCPU * waiter, bool & busy){
+    return CMyCPU::evictFrame(waiter, busy);
+}
+static uint32_t compactRun(){
+    return CMyCPU::compactRun();
+}
+static void mergeFrame(uint32_t frame){
+    CMyCPU::mergeFrame(frame);
+}
+////----------------------------------------------------------------------------------------------------------CStatsDump
+/** Background thread printing MemMgrStats to stderr every m_period ms, one line in total and one per process. */
+static class CStatsDump{
+private:
+    static const uint32_t PROCS = PROCESS_MAX;
+    uint32_t m_period = 0;
+    bool m_run = false;
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t m_cond = PTHREAD_COND_INITIALIZER;
+    static void print(const char * name, const TMemProcStats & p){
+        fprintf(stderr, "%s limit %u mapped %u resident %u reserved %u swapped %u zram %u tables %u"
+                " faults lazy %llu file %llu swap %llu zram %llu cow %llu frames +%llu -%llu fork %llu B\n",
+                name, p.m_Limit, p.m_Mapped, p.m_Resident, p.m_Reserved, p.m_Swapped, p.m_Compressed, p.m_Tables,
+                (unsigned long long) p.m_LazyFaults, (unsigned long long) p.m_FileFaults,
+                (unsigned long long) p.m_SwapFaults, (unsigned long long) p.m_ZramFaults,
+                (unsigned long long) p.m_CowFaults, (unsigned long long) p.m_FramesAllocated,
+                (unsigned long long) p.m_FramesFreed, (unsigned long long) p.m_ForkBytes);
+    }
+    static void dump(){
+        TMemStats stats;
+        TMemProcStats procs[PROCS];
+        uint32_t count = MemMgrStats(stats, procs, PROCS);
+        fprintf(stderr, "memmgr: %u processes (%u created), %u free frames, pool lock waits %llu (%llu us)\n",
+                stats.m_Processes, stats.m_Created, stats.m_FreeFrames, (unsigned long long) stats.m_PoolWaits,
+                (unsigned long long) stats.m_PoolWaitNs / 1000);
+        print("  total", stats.m_Total);
+        for (uint32_t i = 0; i < count && i < PROCS; i++){
+            char name[16];
+            snprintf(name, sizeof(name), "  pid %u", procs[i].m_Pid);
+            print(name, procs[i]);
+        }
+    }
+    static void * dumpMain(void * dumper){
+        auto * self = (CStatsDump *) dumper;
+        pthread_mutex_lock(&self->m_mutex);
+        while (self->m_run){
+            timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += self->m_period / 1000;
+            until.tv_nsec += (self->m_period % 1000) * 1000000;
+            if (until.tv_nsec >= 1000000000){ until.tv_sec++; until.tv_nsec -= 1000000000; }
+            if (pthread_cond_timedwait(&self->m_cond, &self->m_mutex, &until) != 0 && self->m_run)
+                dump();
+        }
+        pthread_mutex_unlock(&self->m_mutex);
+        return nullptr;
+    }
+public:
+    void start(uint32_t period){
+        m_period = period;
+        if (period == 0) return;
+        m_run = true;
+        pthread_create(&m_thread, nullptr, dumpMain, this);
+    }
+    void stop(){
+        if (!m_run) return;
+        pthread_mutex_lock(&m_mutex);
+        m_run = false;
+        pthread_cond_signal(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+        pthread_join(m_thread, nullptr);
+    }
+} statsDump;
 ////--------------------------------------------------------------------------------------------------------------MemMgr
+/**
+ * Nastaveni spravce pameti, vola se pred MemMgr.
+ * @param config nastaveni platne pro vsechny nasledujici behy MemMgr
+ */
+void MemMgrConfig(const TMemMgrConfig &config){
+    g_Config = config;
+}
+
+void MemMgrFragStats(TMemFragStats &stats){
+    framePool.stats(stats);
+}
+
+void MemMgrMergeStats(TMemMergeStats &stats){
+    mergeScanner.stats(stats);
+}
+
+uint32_t MemMgrStats(TMemStats &stats, TMemProcStats *procs, uint32_t max){
+    return CMyCPU::stats(stats, procs, max);
+}
+
+bool MemMgrCompact(void){
+    if (!g_Config.m_Compaction)
+        return false;
+    uint32_t run = CMyCPU::compactRun();
+    if (run == NO_FRAME)
+        return false;
+    framePool.freeBlock(run, CFramePool::MAX_ORDER);
+    return true;
+}
+
 /**
  * Funkce zinicializuje Vaše interní struktury pro správu paměti, vytvoří instanci simulovaného procesoru a spustí předanou funkci.
  * Zatím ještě není potřeba vytvářet nová vlákna - init poběží v hlavním vláknu.
@@ -259,23 +2918,50 @@ void MemMgr(void *mem, uint32_t totalPages, void *processArg, void (*mainProcess
     #ifdef DEBUG_PRINT
     printf("Start\n");
     #endif /*DEBUG_PRINT*/
-    pageStack.init(totalPages);
-    uint32_t rootTableAddress = ((pageStack.pop() << CCPU::OFFSET_BITS) | CCPU::BIT_USER | CCPU::BIT_WRITE | CCPU::BIT_PRESENT);
+    framePool.init((uint8_t *) mem, totalPages);
+    frameTable.init(totalPages);
+    processPool.init(g_Config.m_ProcessThreads);
+    // init jeste nema vlastni cache, root tabulku vezme primo z prvni davky
+    uint32_t frames[CFramePool::BATCH];
+    uint32_t count = framePool.popBatch(frames);
+    framePool.take(1);
+    if (count > 1) framePool.pushBatch(frames + 1, count - 1);
+    framePool.clear(frames[0]);
+    largePool.init(totalPages, g_Config.m_LargePages);
+    framePool.startZeroing(g_Config.m_ZeroLow, g_Config.m_ZeroHigh);
+    CMyCPU::s_TotalPages = totalPages;
+    CMyCPU::resetStats();
+    // bez swap souboru se jede bez overcommitu i bez zram, ta jen setri zapisy do swapu
+    if (g_Config.m_SwapPages != 0 && swapFile.init(g_Config.m_SwapFile, g_Config.m_SwapPages)){
+        framePool.give(g_Config.m_SwapPages);
+        if (g_Config.m_ZramPages != 0)
+            zram.init((uint8_t *) mem, totalPages, g_Config.m_ZramPages);
+    }
+    mergeScanner.init((uint8_t *) mem, totalPages, g_Config.m_MergeScan, g_Config.m_MergeSleep);
+    uint32_t rootTableAddress = ((frames[0] << CCPU::OFFSET_BITS) | CCPU::BIT_USER | CCPU::BIT_WRITE | CCPU::BIT_PRESENT);
     #ifdef DEBUG_PRINT
     printf("init root table idx: %d\n", rootTableAddress >> CCPU::OFFSET_BITS);
     printf("total pages: %d\n", totalPages);
     #endif /*DEBUG_PRINT*/
     CMyCPU * cpu = new CMyCPU((uint8_t*)mem, rootTableAddress);
+    statsDump.start(g_Config.m_StatsDump);
 
     mainProcess(cpu, processArg);
 
-    while (runningProcess != 0){
-        pthread_mutex_lock(&runningMtx);
-        pthread_cond_wait(&runningCond, &runningMtx);
-        pthread_mutex_unlock(&runningMtx);
-    }
+    processPool.wait();
+    mergeScanner.stop();
+    statsDump.stop();
     delete cpu;
-    pageStack.deleteStack();
+    processPool.done();
+    framePool.stopZeroing();
+    swapFile.done();
+    zram.done();
+    mergeScanner.done();
+    shmTable.done();
+    fileTable.done();
+    largePool.done();
+    framePool.done();
+    frameTable.deleteTable();
     #ifdef DEBUG_PRINT
     printf("End\n");
     #endif /*DEBUG_PRINT*/
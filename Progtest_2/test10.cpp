@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// shared memory: a segment attached by several processes at different addresses, inherited by a forked process,
+// removed while still attached. The frames of a segment stay in the memory, swap cannot stand in for them
+
+static const uint32_t  PAGES      = 8 * 1024;
+static const uint32_t  SWAP       = 4000;
+static const uint32_t  SEG_PAGES  = 1500;
+static const uint32_t  SEG_ADDR   = 0x01000000;
+
+static uint32_t          g_Segment;
+static pthread_barrier_t g_Barrier;
+static sem_t             g_Done;
+
+static void        checkRead                               ( CCPU            * cpu,
+                                                             uint32_t          addr,
+                                                             uint32_t          expected )
+{
+  uint32_t val;
+  if ( ! cpu -> ReadInt ( addr, val ) )
+    reportError ( "ReadInt ( %x ) failed\n", addr );
+  else if ( val != expected )
+    reportError ( "read mismatch at %x: %u, expected %u\n", addr, val, expected );
+}
+
+static void        waitChildren                            ( uint32_t          count )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    sem_wait ( &g_Done );
+}
+
+static void        consumerProcess                         ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t base = (uint32_t) (uintptr_t) arg, val;
+  if ( ! cpu -> ShmAttach ( g_Segment, base ) )
+    reportError ( "ShmAttach ( %x ) failed\n", base );
+  pthread_barrier_wait ( &g_Barrier );
+  // the init process has filled the segment
+  for ( uint32_t page = 0; page < SEG_PAGES; page += 7 )
+    checkRead ( cpu, base + page * CCPU::PAGE_SIZE + 8, page * 3 + 1 );
+  if ( ! cpu -> WriteInt ( base + 4, base ) )
+    reportError ( "WriteInt to the segment at %x failed\n", base );
+  pthread_barrier_wait ( &g_Barrier );
+  if ( ! cpu -> ShmDetach ( base ) )
+    reportError ( "ShmDetach ( %x ) failed\n", base );
+  if ( cpu -> ReadInt ( base, val ) )
+    reportError ( "ReadInt of a detached segment succeeded\n" );
+  sem_post ( &g_Done );
+}
+
+static void        forkedProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkRead ( cpu, SEG_ADDR + 9 * CCPU::PAGE_SIZE + 8, 28 );
+  checkRead ( cpu, 0, 55 );
+  // the segment is shared, the memory limit range is copy-on-write
+  if ( ! cpu -> WriteInt ( SEG_ADDR + 12, 99 ) || ! cpu -> WriteInt ( 0, 66 ) )
+    reportError ( "WriteInt in the forked process failed\n" );
+  checkResize ( cpu, 0 );
+  sem_post ( &g_Done );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, 100 );
+  if ( ! cpu -> WriteInt ( 0, 55 ) )
+    reportError ( "WriteInt ( 0 ) failed\n" );
+  if ( cpu -> ShmAttach ( 12345, SEG_ADDR ) )
+    reportError ( "ShmAttach of an unknown segment succeeded\n" );
+
+  g_Segment = cpu -> ShmCreate ( SEG_PAGES );
+  if ( ! g_Segment )
+    reportError ( "ShmCreate failed\n" );
+  // in the memory limit range, not aligned, past the address space
+  if ( cpu -> ShmAttach ( g_Segment, 0x1000 ) || cpu -> ShmAttach ( g_Segment, SEG_ADDR + 1 )
+       || cpu -> ShmAttach ( g_Segment, 0xffff0000 ) )
+    reportError ( "ShmAttach at an invalid address succeeded\n" );
+  if ( ! cpu -> ShmAttach ( g_Segment, SEG_ADDR ) )
+    reportError ( "ShmAttach failed\n" );
+  if ( cpu -> ShmAttach ( g_Segment, SEG_ADDR + 10 * CCPU::PAGE_SIZE ) )
+    reportError ( "overlapping ShmAttach succeeded\n" );
+  if ( cpu -> SetMemLimit ( 5000 ) )
+    reportError ( "SetMemLimit grew into the segment\n" );
+  checkResize ( cpu, 1024 );
+
+  pthread_barrier_init ( &g_Barrier, NULL, 3 );
+  sem_init ( &g_Done, 0, 0 );
+  if ( ! cpu -> NewProcess ( (void *) 0x02003000, consumerProcess, false )
+       || ! cpu -> NewProcess ( (void *) 0x40000000, consumerProcess, false ) )
+    reportError ( "NewProcess failed\n" );
+  for ( uint32_t page = 0; page < SEG_PAGES; page ++ )
+    if ( ! cpu -> WriteInt ( SEG_ADDR + page * CCPU::PAGE_SIZE + 8, page * 3 + 1 ) )
+      reportError ( "WriteInt to the segment page %u failed\n", page );
+  pthread_barrier_wait ( &g_Barrier );
+  pthread_barrier_wait ( &g_Barrier );
+  uint32_t val;
+  if ( ! cpu -> ReadInt ( SEG_ADDR + 4, val ) || ( val != 0x02003000 && val != 0x40000000 ) )
+    reportError ( "the write of a consumer is not visible\n" );
+  waitChildren ( 2 );
+  pthread_barrier_destroy ( &g_Barrier );
+
+  if ( ! cpu -> NewProcess ( NULL, forkedProcess, true ) )
+    reportError ( "fork failed\n" );
+  // removed while two processes have it attached, it stays until both detach
+  if ( ! cpu -> ShmRemove ( g_Segment ) )
+    reportError ( "ShmRemove failed\n" );
+  if ( cpu -> ShmRemove ( g_Segment ) )
+    reportError ( "second ShmRemove succeeded\n" );
+  if ( cpu -> ShmAttach ( g_Segment, 0x50000000 ) )
+    reportError ( "ShmAttach of a removed segment succeeded\n" );
+  waitChildren ( 1 );
+  sem_destroy ( &g_Done );
+  checkRead ( cpu, SEG_ADDR + 12, 99 );
+  checkRead ( cpu, 0, 55 );
+  if ( ! cpu -> ShmDetach ( SEG_ADDR ) )
+    reportError ( "ShmDetach failed\n" );
+  if ( cpu -> ShmDetach ( SEG_ADDR ) )
+    reportError ( "second ShmDetach succeeded\n" );
+  checkResize ( cpu, 0 );
+
+  // the forked process detaches the segment as it ends, then nearly the whole memory fits one segment but not more
+  // than the memory
+  uint32_t big = 0;
+  for ( int i = 0; i < 5000 && ! ( big = cpu -> ShmCreate ( PAGES - 100 ) ); i ++ )
+    usleep ( 1000 );
+  if ( ! big || ! cpu -> ShmAttach ( big, 0x80000000 )
+       || ! cpu -> WriteInt ( 0x80000000 + ( PAGES - 101 ) * CCPU::PAGE_SIZE, 1 ) )
+    reportError ( "the segment of %u pages failed\n", PAGES - 100 );
+  if ( cpu -> ShmCreate ( 200 ) )
+    reportError ( "ShmCreate beyond the memory succeeded\n" );
+  if ( ! cpu -> ShmRemove ( big ) || ! cpu -> ShmDetach ( 0x80000000 ) )
+    reportError ( "ShmRemove / ShmDetach of the big segment failed\n" );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int run = 0; run < 3; run ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = run > 0;
+    config . m_SwapPages = run > 1 ? SWAP : 0;
+    config . m_SwapFile = "test10.swap";
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  testEnd ( "test #11" );
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,214 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// sparse regions: MemMap / MemUnmap around the memory limit range, a forked copy of the regions, then random maps,
+// unmaps and accesses compared with a model of the address range
+
+static const uint32_t  PAGES      = 8 * 1024;
+static const uint32_t  SWAP       = 4000;
+static const uint32_t  HEAP       = 0x01000000;
+static const uint32_t  STACK      = 0xBFF00000;
+static const uint32_t  RDONLY     = 0x40000000;
+static const uint32_t  MODEL_BASE = 0x10000000;
+static const uint32_t  MODEL_SPAN = 16 * 1024;
+static const uint32_t  MODEL_OPS  = 20000;
+
+// model of the pages from MODEL_BASE on: 0 unmapped, 1 writable, 2 read only
+static uint8_t         g_State[MODEL_SPAN];
+static uint32_t        g_Value[MODEL_SPAN];
+static sem_t           g_Done;
+
+static void        checkRead                               ( CCPU            * cpu,
+                                                             uint32_t          addr,
+                                                             uint32_t          expected )
+{
+  uint32_t val;
+  if ( ! cpu -> ReadInt ( addr, val ) )
+    reportError ( "ReadInt ( %x ) failed\n", addr );
+  else if ( val != expected )
+    reportError ( "read mismatch at %x: %u, expected %u\n", addr, val, expected );
+}
+
+
+static void        forkedProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t val;
+  checkRead ( cpu, HEAP + 4 * CCPU::PAGE_SIZE, 44 );
+  if ( ! cpu -> WriteInt ( HEAP + 4 * CCPU::PAGE_SIZE, 45 ) )
+    reportError ( "copy-on-write of a region page failed\n" );
+  if ( cpu -> WriteInt ( RDONLY, 1 ) )
+    reportError ( "WriteInt to a read only region succeeded\n" );
+  checkRead ( cpu, RDONLY, 0 );
+  checkRead ( cpu, 0xBFFFF000, 77 );
+  if ( ! cpu -> MemUnmap ( HEAP, 256 ) || cpu -> ReadInt ( HEAP, val ) )
+    reportError ( "MemUnmap in the forked process failed\n" );
+  checkResize ( cpu, 0 );
+  sem_post ( &g_Done );
+}
+
+static void        randomModel                             ( CCPU            * cpu )
+{
+  uint32_t val;
+  memset ( g_State, 0, sizeof ( g_State ) );
+  srand ( 5 );
+  for ( uint32_t op = 0; op < MODEL_OPS; op ++ )
+  {
+    uint32_t page = rand () % MODEL_SPAN, pages = 1 + rand () % ( rand () % 8 ? 64 : 3000 );
+    if ( page + pages > MODEL_SPAN )
+      pages = MODEL_SPAN - page;
+    int kind = rand () % 10;
+    if ( kind < 4 )
+    {
+      bool free = true, write = rand () % 4;
+      for ( uint32_t i = page; i < page + pages; i ++ )
+        free = free && ! g_State[i];
+      bool ok = cpu -> MemMap ( MODEL_BASE + page * CCPU::PAGE_SIZE, pages, write );
+      // large regions may not fit the memory
+      if ( ok ? ! free : free && pages <= 1000 )
+        reportError ( "MemMap ( %u, %u ) returned %d, the range is %s\n", page, pages, ok, free ? "free" : "used" );
+      if ( ok )
+        for ( uint32_t i = page; i < page + pages; i ++ )
+        {
+          g_State[i] = write ? 1 : 2;
+          g_Value[i] = 0;
+        }
+    }
+    else if ( kind < 7 )
+    {
+      if ( ! cpu -> MemUnmap ( MODEL_BASE + page * CCPU::PAGE_SIZE, pages ) )
+        reportError ( "MemUnmap ( %u, %u ) failed\n", page, pages );
+      memset ( g_State + page, 0, pages );
+    }
+    else
+      for ( uint32_t i = page; i < page + pages && i < page + 40; i ++ )
+        if ( rand () % 2 )
+        {
+          bool ok = cpu -> WriteInt ( MODEL_BASE + i * CCPU::PAGE_SIZE, op );
+          if ( ok != ( g_State[i] == 1 ) )
+            reportError ( "WriteInt to page %u (state %u) returned %d\n", i, g_State[i], ok );
+          if ( ok )
+            g_Value[i] = op;
+        }
+        else
+        {
+          bool ok = cpu -> ReadInt ( MODEL_BASE + i * CCPU::PAGE_SIZE, val );
+          if ( ok != ( g_State[i] != 0 ) || ( ok && val != g_Value[i] ) )
+            reportError ( "ReadInt of page %u (state %u) returned %d, %u, expected %u\n", i, g_State[i], ok, val,
+                          g_Value[i] );
+        }
+  }
+  if ( ! cpu -> MemUnmap ( MODEL_BASE, MODEL_SPAN ) )
+    reportError ( "MemUnmap of the model range failed\n" );
+  for ( uint32_t i = 0; i < MODEL_SPAN; i += 97 )
+    if ( cpu -> ReadInt ( MODEL_BASE + i * CCPU::PAGE_SIZE, val ) )
+      reportError ( "ReadInt of an unmapped page %u succeeded\n", i );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t val;
+  checkResize ( cpu, 10 );
+  if ( ! cpu -> MemMap ( HEAP, 256, true ) || ! cpu -> MemMap ( STACK, 256, true )
+       || ! cpu -> MemMap ( RDONLY, 16, false ) || ! cpu -> MemMap ( 0xfffff000, 1, true ) )
+    reportError ( "MemMap failed\n" );
+  // overlap, in the memory limit range, not aligned, wraps around
+  if ( cpu -> MemMap ( HEAP + 255 * CCPU::PAGE_SIZE, 2, true ) || cpu -> MemMap ( 0x2000, 1, true )
+       || cpu -> MemMap ( 0x3000001, 1, true ) || cpu -> MemMap ( 0xffffe000, 3, true ) )
+    reportError ( "MemMap of an invalid range succeeded\n" );
+  if ( cpu -> SetMemLimit ( 1025 * 4 ) )
+    reportError ( "SetMemLimit grew into the heap\n" );
+  checkResize ( cpu, 1024 );
+  rwTest ( cpu, 0, 1024 );
+
+  checkRead ( cpu, HEAP + 100 * CCPU::PAGE_SIZE, 0 );
+  if ( ! cpu -> WriteInt ( HEAP + 4 * CCPU::PAGE_SIZE, 44 ) || ! cpu -> WriteInt ( 0xBFFFF000, 77 ) )
+    reportError ( "WriteInt to a region failed\n" );
+  if ( cpu -> WriteInt ( RDONLY, 1 ) )
+    reportError ( "WriteInt to a read only region succeeded\n" );
+  checkRead ( cpu, RDONLY + 15 * CCPU::PAGE_SIZE, 0 );
+  if ( cpu -> ReadInt ( RDONLY + 16 * CCPU::PAGE_SIZE, val ) )
+    reportError ( "ReadInt past a region succeeded\n" );
+
+  sem_init ( &g_Done, 0, 0 );
+  if ( ! cpu -> NewProcess ( NULL, forkedProcess, true ) )
+    reportError ( "fork failed\n" );
+  sem_wait ( &g_Done );
+  sem_destroy ( &g_Done );
+  checkRead ( cpu, HEAP + 4 * CCPU::PAGE_SIZE, 44 );
+
+  // unmapping the middle splits the heap, the hole can be mapped again
+  if ( ! cpu -> MemUnmap ( HEAP + 100 * CCPU::PAGE_SIZE, 10 ) )
+    reportError ( "MemUnmap of the middle failed\n" );
+  if ( cpu -> ReadInt ( HEAP + 105 * CCPU::PAGE_SIZE, val ) )
+    reportError ( "ReadInt of an unmapped page succeeded\n" );
+  checkRead ( cpu, HEAP + 99 * CCPU::PAGE_SIZE, 0 );
+  checkRead ( cpu, HEAP + 110 * CCPU::PAGE_SIZE, 0 );
+  if ( ! cpu -> MemMap ( HEAP + 102 * CCPU::PAGE_SIZE, 3, false ) )
+    reportError ( "MemMap into the hole failed\n" );
+
+  // a shared segment is only detached, MemUnmap cannot take a part of it
+  uint32_t id = cpu -> ShmCreate ( 4 );
+  if ( ! id || ! cpu -> ShmAttach ( id, 0x50000000 ) )
+    reportError ( "shared segment failed\n" );
+  if ( cpu -> MemUnmap ( 0x50000000, 1 ) || cpu -> ShmDetach ( HEAP ) )
+    reportError ( "segment unmapped by MemUnmap or a region detached by ShmDetach\n" );
+  if ( ! cpu -> ShmRemove ( id ) || ! cpu -> ShmDetach ( 0x50000000 ) )
+    reportError ( "ShmRemove / ShmDetach failed\n" );
+
+  randomModel ( cpu );
+
+  // unmapping all but the last page of the address space leaves the memory limit range alone
+  if ( ! cpu -> MemUnmap ( 0, 0xfffff ) )
+    reportError ( "MemUnmap of everything failed\n" );
+  checkRead ( cpu, 0x1000, 0x1000 ^ 0 );
+  checkRead ( cpu, 0xfffff000, 0 );
+  if ( cpu -> ReadInt ( HEAP, val ) || cpu -> ReadInt ( STACK, val ) )
+    reportError ( "ReadInt of an unmapped region succeeded\n" );
+  if ( ! cpu -> MemUnmap ( 0xfffff000, 1 ) )
+    reportError ( "MemUnmap of the last page failed\n" );
+  checkResize ( cpu, 0 );
+
+  // once the forked process has ended, all the frames and page tables are back and nearly the whole memory fits one
+  // region
+  bool mapped = false;
+  for ( int i = 0; i < 5000 && ! ( mapped = cpu -> MemMap ( 0x80000000, PAGES - 30, true ) ); i ++ )
+    usleep ( 1000 );
+  if ( ! mapped || ! cpu -> WriteInt ( 0x80000000 + ( PAGES - 31 ) * CCPU::PAGE_SIZE, 3 ) )
+    reportError ( "region of %u pages failed\n", PAGES - 30 );
+  if ( ! cpu -> MemUnmap ( 0x80000000, PAGES - 30 ) )
+    reportError ( "MemUnmap of the big region failed\n" );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int run = 0; run < 3; run ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = run > 0;
+    config . m_SwapPages = run > 1 ? SWAP : 0;
+    config . m_SwapFile = "test11.swap";
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  testEnd ( "test #12" );
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// file mappings: a read only file read sequentially with readahead and past its end, a writable file with an offset
+// written back by MemSync, MemUnmap, process exit and page replacement, a file that ends inside a page under memory
+// pressure. The host files are checked directly
+
+static const uint32_t  PAGES      = 1024;
+static const uint32_t  SWAP       = 2000;
+static const uint32_t  RO_BYTES   = 300 * CCPU::PAGE_SIZE + 100;
+static const uint32_t  RO_PAGES   = 310;
+static const uint32_t  RW_PAGES   = 1500;
+static const uint32_t  EOF_BYTES  = 10000;
+static const uint32_t  EOF_PAGES  = 8;
+static const char    * RO_FILE    = "test12.ro";
+static const char    * RW_FILE    = "test12.rw";
+static const char    * EOF_FILE   = "test12.eof";
+
+static sem_t           g_Done;
+
+static uint32_t    fileValue                               ( uint32_t          index )
+{
+  return index * 7 + 1;
+}
+
+static void        makeFile                                ( const char      * path,
+                                                             uint32_t          bytes )
+{
+  FILE * f = fopen ( path, "wb" );
+  for ( uint32_t i = 0; f && i < bytes / 4; i ++ )
+  {
+    uint32_t val = fileValue ( i );
+    fwrite ( &val, sizeof ( val ), 1, f );
+  }
+  for ( uint32_t i = bytes / 4 * 4; f && i < bytes; i ++ )
+    fputc ( 0, f );
+  if ( ! f || fclose ( f ) )
+    reportError ( "cannot create %s\n", path );
+}
+
+static uint32_t    fileWord                                ( const char      * path,
+                                                             uint32_t          index )
+{
+  uint32_t val = 0;
+  FILE * f = fopen ( path, "rb" );
+  if ( ! f || fseek ( f, index * 4, SEEK_SET ) || fread ( &val, sizeof ( val ), 1, f ) != 1 )
+    reportError ( "cannot read word %u of %s\n", index, path );
+  if ( f )
+    fclose ( f );
+  return val;
+}
+
+static long        fileSize                                ( const char      * path )
+{
+  FILE * f = fopen ( path, "rb" );
+  long size = -1;
+  if ( f && ! fseek ( f, 0, SEEK_END ) )
+    size = ftell ( f );
+  if ( f )
+    fclose ( f );
+  return size;
+}
+
+static void        checkRead                               ( CCPU            * cpu,
+                                                             uint32_t          addr,
+                                                             uint32_t          expected )
+{
+  uint32_t val;
+  if ( ! cpu -> ReadInt ( addr, val ) )
+    reportError ( "ReadInt ( %x ) failed\n", addr );
+  else if ( val != expected )
+    reportError ( "read mismatch at %x: %u, expected %u\n", addr, val, expected );
+}
+
+static void        forkedProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkRead ( cpu, 0x10000000 + 2 * CCPU::PAGE_SIZE, fileValue ( 2 * 1024 ) );
+  sem_post ( &g_Done );
+}
+
+// ends with a changed page of a mapping it never unmapped
+static void        writerProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  if ( ! cpu -> MapFile ( 0x30000000, 4, RW_FILE, 20 * CCPU::PAGE_SIZE, true )
+       || ! cpu -> WriteInt ( 0x30000000 + 8, 0xabcdef ) )
+    reportError ( "writer: MapFile / WriteInt failed\n" );
+}
+
+static void        readOnlyFile                            ( CCPU            * cpu )
+{
+  if ( ! cpu -> MapFile ( 0x10000000, RO_PAGES, RO_FILE, 0, false ) )
+    reportError ( "MapFile ( %s ) failed\n", RO_FILE );
+  for ( uint32_t page = 0; page < RO_PAGES; page ++ )
+    for ( uint32_t word = 0; word < 1024; word += 255 )
+    {
+      uint32_t index = page * 1024 + word;
+      checkRead ( cpu, 0x10000000 + index * 4, index < RO_BYTES / 4 ? fileValue ( index ) : 0 );
+    }
+  if ( cpu -> WriteInt ( 0x10000000, 1 ) )
+    reportError ( "WriteInt to a read only mapping succeeded\n" );
+  if ( cpu -> MapFile ( 0x20000000, 4, "/nonexistent/file", 0, false )
+       || cpu -> MapFile ( 0x20000000, 4, RO_FILE, 100, false ) )
+    reportError ( "MapFile of a missing file or at an unaligned offset succeeded\n" );
+  sem_init ( &g_Done, 0, 0 );
+  if ( ! cpu -> NewProcess ( NULL, forkedProcess, true ) )
+    reportError ( "fork failed\n" );
+  sem_wait ( &g_Done );
+  sem_destroy ( &g_Done );
+}
+
+static void        writableFile                            ( CCPU            * cpu,
+                                                             bool              swap )
+{
+  uint32_t val;
+  // with an offset of 8 pages, written back by MemSync only
+  if ( ! cpu -> MapFile ( 0x20000000, 100, RW_FILE, 8 * CCPU::PAGE_SIZE, true ) )
+    reportError ( "MapFile ( %s ) failed\n", RW_FILE );
+  checkRead ( cpu, 0x20000000, fileValue ( 8 * 1024 ) );
+  if ( ! cpu -> WriteInt ( 0x20000000 + 4, 111 ) )
+    reportError ( "WriteInt to the file mapping failed\n" );
+  if ( fileWord ( RW_FILE, 8 * 1024 + 1 ) != fileValue ( 8 * 1024 + 1 ) )
+    reportError ( "page written back before MemSync\n" );
+  if ( ! cpu -> MemSync ( 0x20000000, 100 ) || fileWord ( RW_FILE, 8 * 1024 + 1 ) != 111 )
+    reportError ( "MemSync did not write the page back\n" );
+
+  // unmapping the middle writes it back, the split tail keeps its file offset
+  if ( ! cpu -> WriteInt ( 0x20000000 + 50 * CCPU::PAGE_SIZE, 222 )
+       || ! cpu -> WriteInt ( 0x20000000 + 70 * CCPU::PAGE_SIZE, 333 ) )
+    reportError ( "WriteInt to the file mapping failed\n" );
+  if ( ! cpu -> MemUnmap ( 0x20000000 + 40 * CCPU::PAGE_SIZE, 20 ) )
+    reportError ( "MemUnmap of the middle failed\n" );
+  if ( fileWord ( RW_FILE, ( 8 + 50 ) * 1024 ) != 222
+       || fileWord ( RW_FILE, ( 8 + 70 ) * 1024 ) != fileValue ( ( 8 + 70 ) * 1024 ) )
+    reportError ( "MemUnmap wrote back the wrong pages\n" );
+  checkRead ( cpu, 0x20000000 + 70 * CCPU::PAGE_SIZE, 333 );
+  checkRead ( cpu, 0x20000000 + 80 * CCPU::PAGE_SIZE + 4, fileValue ( ( 8 + 80 ) * 1024 + 1 ) );
+  if ( ! cpu -> MemUnmap ( 0x20000000, 100 ) || fileWord ( RW_FILE, ( 8 + 70 ) * 1024 ) != 333 )
+    reportError ( "MemUnmap of the tail did not write it back\n" );
+
+  // written back when the process ends
+  if ( ! cpu -> NewProcess ( NULL, writerProcess, false ) )
+    reportError ( "NewProcess failed\n" );
+  for ( int i = 0; i < 5000 && fileWord ( RW_FILE, 20 * 1024 + 2 ) != 0xabcdef; i ++ )
+    usleep ( 1000 );
+  if ( fileWord ( RW_FILE, 20 * 1024 + 2 ) != 0xabcdef )
+    reportError ( "process exit did not write the page back\n" );
+
+  // the pages of a mapping are committed memory, with swap more than the memory can be mapped and changed pages go
+  // back to the file to make room
+  uint32_t pages = swap ? RW_PAGES : PAGES / 2;
+  if ( ! cpu -> MapFile ( 0x40000000, pages, RW_FILE, 0, true ) )
+    reportError ( "MapFile of %u pages failed\n", pages );
+  for ( uint32_t page = 0; page < pages; page ++ )
+    if ( ! cpu -> WriteInt ( 0x40000000 + page * CCPU::PAGE_SIZE + 12, page ^ 0x5555 ) )
+      reportError ( "WriteInt to page %u of the big mapping failed\n", page );
+  for ( uint32_t page = 0; page < pages; page ++ )
+  {
+    if ( ! cpu -> ReadInt ( 0x40000000 + page * CCPU::PAGE_SIZE + 12, val ) || val != ( page ^ 0x5555 ) )
+      reportError ( "page %u of the big mapping lost its write\n", page );
+    checkRead ( cpu, 0x40000000 + page * CCPU::PAGE_SIZE + 16, fileValue ( page * 1024 + 4 ) );
+  }
+  if ( ! cpu -> MemUnmap ( 0x40000000, pages ) )
+    reportError ( "MemUnmap of the big mapping failed\n" );
+  for ( uint32_t page = 0; page < pages; page += 13 )
+    if ( fileWord ( RW_FILE, page * 1024 + 3 ) != ( page ^ 0x5555 ) )
+      reportError ( "page %u of the big mapping was not written back\n", page );
+}
+
+// the last page of the file is partial: it reads as zeros past the end, its changes survive replacement and only
+// the bytes inside the file are written, the file keeps its size
+static void        partialPage                             ( CCPU            * cpu,
+                                                             bool              swap )
+{
+  if ( ! cpu -> MapFile ( 0x50000000, EOF_PAGES, EOF_FILE, 0, true ) )
+    reportError ( "MapFile ( %s ) failed\n", EOF_FILE );
+  checkRead ( cpu, 0x50000000 + EOF_BYTES / 4 * 4 + 4, 0 );
+  for ( uint32_t addr = 0; addr < EOF_PAGES * CCPU::PAGE_SIZE; addr += 4 )
+    if ( ! cpu -> WriteInt ( 0x50000000 + addr, addr ^ 0x7777 ) )
+      reportError ( "WriteInt ( %x ) to the partial file failed\n", addr );
+  if ( ! cpu -> MemSync ( 0x50000000, EOF_PAGES ) )
+    reportError ( "MemSync of the partial file failed\n" );
+  // with swap the memory limit pushes the mapped pages out
+  uint32_t pressure = swap ? PAGES : PAGES / 2;
+  for ( int round = 0; round < 2; round ++ )
+  {
+    checkResize ( cpu, pressure );
+    wTest ( cpu, 0, pressure );
+    checkResize ( cpu, 0 );
+  }
+  for ( uint32_t addr = 0; addr < EOF_PAGES * CCPU::PAGE_SIZE; addr += 4 )
+    checkRead ( cpu, 0x50000000 + addr, addr ^ 0x7777 );
+  if ( ! cpu -> MemUnmap ( 0x50000000, EOF_PAGES ) )
+    reportError ( "MemUnmap of the partial file failed\n" );
+  if ( fileSize ( EOF_FILE ) != EOF_BYTES )
+    reportError ( "%s has %ld bytes, %u expected\n", EOF_FILE, fileSize ( EOF_FILE ), EOF_BYTES );
+  for ( uint32_t i = 0; i < EOF_BYTES / 4; i += 17 )
+    if ( fileWord ( EOF_FILE, i ) != ( i * 4 ^ 0x7777 ) )
+      reportError ( "word %u of %s was not written back\n", i, EOF_FILE );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  readOnlyFile ( cpu );
+  writableFile ( cpu, arg != NULL );
+  partialPage ( cpu, arg != NULL );
+  if ( ! cpu -> MemUnmap ( 0x10000000, RO_PAGES ) )
+    reportError ( "MemUnmap of the read only file failed\n" );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int run = 0; run < 3; run ++ )
+  {
+    makeFile ( RO_FILE, RO_BYTES );
+    makeFile ( RW_FILE, RW_PAGES * CCPU::PAGE_SIZE );
+    makeFile ( EOF_FILE, EOF_BYTES );
+    TMemMgrConfig config;
+    config . m_LazyAlloc = run > 0;
+    config . m_SwapPages = run > 1 ? SWAP : 0;
+    config . m_ZramPages = run > 1 ? SWAP : 0;
+    config . m_SwapFile = "test12.swap";
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, run > 1 ? (void *) 1 : NULL, initProcess );
+  }
+  unlink ( RO_FILE );
+  unlink ( RW_FILE );
+  unlink ( EOF_FILE );
+  testEnd ( "test #13" );
+  delete [] mem;
+  return 0;
+}
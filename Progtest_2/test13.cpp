@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// same-page merging: processes fill their memory with the same 50 page contents at shifted addresses, the merging
+// thread maps them to shared read-only frames. The init process then claims all the free memory, the writes that
+// break the sharing again must still get their copies from the claims the merged pages kept
+
+static const uint32_t  PAGES      = 4 * 1024;
+static const uint32_t  WORKERS    = 4;
+static const uint32_t  WORK_PAGES = 600;
+static const uint32_t  REGION     = 0x10000000;
+static const uint32_t  REG_PAGES  = 200;
+
+static pthread_barrier_t g_Barrier;
+static sem_t             g_Done;
+
+static uint32_t    value                                   ( uint32_t          page,
+                                                             uint32_t          word )
+{
+  return word % 64 ? 0 : ( page % 50 ) * 7 + word;
+}
+
+static void        fill                                    ( CCPU            * cpu,
+                                                             uint32_t          base )
+{
+  for ( uint32_t page = 0; page < WORK_PAGES; page ++ )
+    for ( uint32_t word = 0; word < 1024; word ++ )
+      if ( ! cpu -> WriteInt ( base + page * CCPU::PAGE_SIZE + word * 4, value ( page, word ) ) )
+        reportError ( "WriteInt to page %u failed\n", page );
+}
+
+static void        check                                   ( CCPU            * cpu,
+                                                             uint32_t          base,
+                                                             uint32_t          id )
+{
+  uint32_t val;
+  for ( uint32_t page = 0; page < WORK_PAGES; page ++ )
+    for ( uint32_t word = 0; word < 1024; word += 64 )
+      if ( ! cpu -> ReadInt ( base + page * CCPU::PAGE_SIZE + word * 4, val ) || val != value ( page, word ) )
+        reportError ( "process %u: page %u word %u differs\n", id, page, word );
+}
+
+static void        waitChildren                            ( uint32_t          count )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    sem_wait ( &g_Done );
+}
+
+static void        workerProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg, val;
+  // shifted, the merged frames are mapped at different pages of each process
+  uint32_t base = id * 3 * CCPU::PAGE_SIZE;
+  checkResize ( cpu, WORK_PAGES + 10 );
+  fill ( cpu, base );
+  if ( ! cpu -> MemMap ( REGION, REG_PAGES, true ) )
+    reportError ( "MemMap failed\n" );
+  for ( uint32_t page = 0; page < REG_PAGES; page += 2 )
+    if ( ! cpu -> WriteInt ( REGION + page * CCPU::PAGE_SIZE, 5 ) )
+      reportError ( "WriteInt to the region failed\n" );
+  pthread_barrier_wait ( &g_Barrier );
+  // merged
+  pthread_barrier_wait ( &g_Barrier );
+  check ( cpu, base, id );
+  // writes break the sharing for this process only
+  for ( uint32_t page = id; page < WORK_PAGES; page += WORKERS )
+    if ( ! cpu -> WriteInt ( base + page * CCPU::PAGE_SIZE + 4, id + 100 ) )
+      reportError ( "process %u: copy-on-write of a merged page %u failed\n", id, page );
+  pthread_barrier_wait ( &g_Barrier );
+  for ( uint32_t page = 0; page < WORK_PAGES; page ++ )
+    if ( ! cpu -> ReadInt ( base + page * CCPU::PAGE_SIZE + 4, val ) || val != ( page % WORKERS == id ? id + 100 : 0 ) )
+      reportError ( "process %u: page %u sees the write of another process\n", id, page );
+  check ( cpu, base, id );
+  checkResize ( cpu, 0 );
+  if ( ! cpu -> MemUnmap ( REGION, REG_PAGES ) )
+    reportError ( "MemUnmap failed\n" );
+  sem_post ( &g_Done );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemMergeStats merge;
+  pthread_barrier_init ( &g_Barrier, NULL, WORKERS + 1 );
+  sem_init ( &g_Done, 0, 0 );
+  for ( uintptr_t i = 0; i < WORKERS; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) i, workerProcess, false ) )
+      reportError ( "NewProcess %u failed\n", (uint32_t) i );
+  pthread_barrier_wait ( &g_Barrier );
+  // all but the 50 contents of the memory limit ranges and one page of each region can be merged
+  for ( int i = 0; i < 5000; i ++ )
+  {
+    MemMgrMergeStats ( merge );
+    if ( merge . m_Saved >= WORKERS * WORK_PAGES - 50 + ( WORKERS - 1 ) * REG_PAGES / 2 )
+      break;
+    usleep ( 1000 );
+  }
+  if ( merge . m_Shared < 50 || merge . m_Saved < WORKERS * WORK_PAGES - 60 || merge . m_Merged < merge . m_Saved
+       || merge . m_Scanned < merge . m_Merged )
+    reportError ( "merge stats: scanned %u, merged %u, shared %u, saved %u\n", merge . m_Scanned, merge . m_Merged,
+                  merge . m_Shared, merge . m_Saved );
+
+  // the saved frames keep their claims, the init process grows as far as it can and takes all the rest
+  uint32_t limit = 0;
+  for ( uint32_t step = PAGES; step; step /= 2 )
+    if ( cpu -> SetMemLimit ( limit + step ) )
+      limit += step;
+  if ( limit == 0 || cpu -> GetMemLimit () != limit )
+    reportError ( "the init process got %u pages, limit %u\n", limit, cpu -> GetMemLimit () );
+  pthread_barrier_wait ( &g_Barrier );
+  pthread_barrier_wait ( &g_Barrier );
+  checkResize ( cpu, 0 );
+  waitChildren ( WORKERS );
+  pthread_barrier_destroy ( &g_Barrier );
+  sem_destroy ( &g_Done );
+}
+
+// without m_MergeScan nothing is scanned
+static void        noMergeProcess                          ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemMergeStats merge;
+  checkResize ( cpu, 100 );
+  for ( uint32_t page = 0; page < 100; page ++ )
+    if ( ! cpu -> WriteInt ( page * CCPU::PAGE_SIZE, 1 ) )
+      reportError ( "WriteInt failed\n" );
+  usleep ( 20000 );
+  MemMgrMergeStats ( merge );
+  if ( merge . m_Scanned || merge . m_Merged || merge . m_Shared || merge . m_Saved )
+    reportError ( "pages merged without m_MergeScan\n" );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    config . m_MergeScan = 512;
+    config . m_MergeSleep = 1;
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  TMemMgrConfig config;
+  MemMgrConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, noMergeProcess );
+  testEnd ( "test #14" );
+  delete [] mem;
+  return 0;
+}
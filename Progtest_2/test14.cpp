@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// fork / exit churn: every process that ends has to give all its frames back, the memory limit the init process
+// can reach must not shrink however many processes have come and gone
+
+static const uint32_t  LIFECYCLES = 1000000;
+static const uint32_t  ALIVE      = 32;
+static const uint32_t  BASE_SIZE  = 256;
+
+static sem_t           g_Alive;
+
+static void        leafProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t pages = (uint32_t) (uintptr_t) arg;
+  if ( cpu -> GetMemLimit () )
+  {
+    // copy-on-write of a few pages shared with the parent
+    for ( uint32_t i = 0; i < BASE_SIZE; i += 64 )
+      if ( ! cpu -> WriteInt ( i * CCPU::PAGE_SIZE + 4, i ) )
+        reportError ( "leaf: write %u failed\n", i );
+  }
+  else if ( pages && cpu -> SetMemLimit ( pages ) && ! cpu -> WriteInt ( ( pages - 1 ) * CCPU::PAGE_SIZE, pages ) )
+    reportError ( "leaf: write to %u pages failed\n", pages );
+  sem_post ( &g_Alive );
+}
+
+static void        forkProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // a process that ends while its own child still runs, the child keeps the shared frames
+  if ( sem_trywait ( &g_Alive ) == 0 && ! cpu -> NewProcess ( nullptr, leafProcess, true ) )
+    sem_post ( &g_Alive );
+  if ( ! cpu -> SetMemLimit ( BASE_SIZE + 100 ) )
+    reportError ( "fork: resize failed\n" );
+  sem_post ( &g_Alive );
+}
+
+static uint32_t    maxLimit                                ( CCPU            * cpu )
+{
+  uint32_t lo = 0, hi = 1 << 20;
+  while ( lo + 1 < hi )
+  {
+    uint32_t mid = ( lo + hi ) / 2;
+    if ( cpu -> SetMemLimit ( mid ) )
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t before = maxLimit ( cpu );
+  checkResize ( cpu, BASE_SIZE );
+  rwiTest ( cpu, 0, BASE_SIZE );
+
+  sem_init ( &g_Alive, 0, ALIVE );
+  for ( uint32_t i = 0; i < LIFECYCLES; i ++ )
+  {
+    sem_wait ( &g_Alive );
+    bool ok;
+    if ( i % 64 == 0 )
+      ok = cpu -> NewProcess ( nullptr, forkProcess, true );
+    else if ( i % 8 == 0 )
+      ok = cpu -> NewProcess ( nullptr, leafProcess, true );
+    else
+      ok = cpu -> NewProcess ( (void *) (uintptr_t) ( i % 5 * 40 ), leafProcess, false );
+    if ( ! ok )
+    {
+      reportError ( "NewProcess %u failed\n", i );
+      sem_post ( &g_Alive );
+    }
+  }
+  for ( uint32_t i = 0; i < ALIVE; i ++ )
+    sem_wait ( &g_Alive );
+  sem_destroy ( &g_Alive );
+
+  rTest ( cpu, 0, BASE_SIZE );
+  checkResize ( cpu, 0 );
+  // the last processes may still be giving their frames back
+  uint32_t after = maxLimit ( cpu );
+  for ( int i = 0; i < 5000 && after != before; i ++ )
+  {
+    usleep ( 1000 );
+    after = maxLimit ( cpu );
+  }
+  if ( after != before )
+    reportError ( "limit reachable before churn %u, after %u\n", before, after );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  const int PAGES = 8 * 1024;
+
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  MemMgr ( memAligned, PAGES, NULL, initProcess );
+  testEnd ( "test #15" );
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// memory manager statistics: the counters of one process and of a forked child are compared with the exact numbers
+// of pages, page tables and faults the operations cause, the totals keep the events of finished processes. Then the
+// counters of the other tiers: swap and zram faults under overcommit, file faults with readahead, large pages
+// without page tables
+
+static const uint32_t  PAGES      = 8 * 1024;
+static const uint32_t  LIMIT      = 2000;
+static const uint32_t  WRITTEN    = 50;
+static const uint32_t  REG_PAGES  = 10;
+static const uint32_t  TABLES     = 3;
+static const uint32_t  SMALL      = 512;
+static const uint32_t  SWAP       = 3000;
+static const uint32_t  FILE_PAGES = 300;
+static const char    * FILE_NAME  = "test15.file";
+
+static bool            g_Lazy;
+static sem_t           g_Checked;
+
+static const TMemProcStats * findProcess                   ( const TMemProcStats * procs,
+                                                             uint32_t          count,
+                                                             uint32_t          pid )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    if ( procs[i] . m_Pid == pid )
+      return procs + i;
+  return NULL;
+}
+
+static void        waitChildren                            ( void )
+{
+  TMemStats stats;
+  while ( MemMgrStats ( stats, NULL, 0 ) > 1 )
+    usleep ( 1000 );
+}
+
+static void        childProcess                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemStats stats;
+  TMemProcStats procs[PROCESS_MAX];
+  // the first WRITTEN pages are shared with the parent, the next ones are lazy or zeroed copies
+  for ( uint32_t page = 0; page < 2 * WRITTEN; page ++ )
+    if ( ! cpu -> WriteInt ( page * CCPU::PAGE_SIZE, 7 ) )
+      reportError ( "child: WriteInt to page %u failed\n", page );
+  uint32_t count = MemMgrStats ( stats, procs, PROCESS_MAX );
+  const TMemProcStats * me = findProcess ( procs, count, 2 );
+  if ( count != 2 || ! me )
+    reportError ( "child: %u processes, pid 2 %s\n", count, me ? "found" : "missing" );
+  else if ( me -> m_Limit != LIMIT || me -> m_Tables != TABLES
+            || me -> m_CowFaults != ( g_Lazy ? WRITTEN : 2 * WRITTEN )
+            || me -> m_LazyFaults != ( g_Lazy ? WRITTEN : 0 ) )
+    reportError ( "child: limit %u, tables %u, cow faults %llu, lazy faults %llu\n", me -> m_Limit, me -> m_Tables,
+                  (unsigned long long) me -> m_CowFaults, (unsigned long long) me -> m_LazyFaults );
+  sem_post ( &g_Checked );
+  checkResize ( cpu, 0 );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemStats stats;
+  TMemProcStats procs[PROCESS_MAX];
+  checkResize ( cpu, LIMIT );
+  for ( uint32_t page = 0; page < WRITTEN; page ++ )
+    if ( ! cpu -> WriteInt ( page * CCPU::PAGE_SIZE, 1 ) )
+      reportError ( "WriteInt to page %u failed\n", page );
+  if ( ! cpu -> MemMap ( 0x10000000, REG_PAGES, true ) )
+    reportError ( "MemMap failed\n" );
+
+  // two page tables for the memory limit range and one for the region
+  if ( MemMgrStats ( stats, procs, PROCESS_MAX ) != 1 || procs[0] . m_Pid != 1 || procs[0] . m_Limit != LIMIT
+       || procs[0] . m_Mapped != LIMIT + REG_PAGES || procs[0] . m_Tables != TABLES )
+    reportError ( "pid %u, limit %u, mapped %u, tables %u\n", procs[0] . m_Pid, procs[0] . m_Limit,
+                  procs[0] . m_Mapped, procs[0] . m_Tables );
+  // lazy pages are reserved until the first access
+  uint32_t resident = g_Lazy ? WRITTEN : LIMIT + REG_PAGES;
+  if ( procs[0] . m_Resident != resident || procs[0] . m_Reserved != LIMIT + REG_PAGES - resident
+       || procs[0] . m_LazyFaults != ( g_Lazy ? WRITTEN : 0 ) || procs[0] . m_FramesAllocated < resident + TABLES )
+    reportError ( "resident %u, reserved %u, lazy faults %llu, frames allocated %llu\n", procs[0] . m_Resident,
+                  procs[0] . m_Reserved, (unsigned long long) procs[0] . m_LazyFaults,
+                  (unsigned long long) procs[0] . m_FramesAllocated );
+
+  sem_init ( &g_Checked, 0, 0 );
+  if ( ! cpu -> NewProcess ( NULL, childProcess, true ) )
+    reportError ( "fork failed\n" );
+  sem_wait ( &g_Checked );
+  waitChildren ();
+  sem_destroy ( &g_Checked );
+
+  // the fork wrote a copy of each page table, the child's faults stay in the totals
+  MemMgrStats ( stats, procs, PROCESS_MAX );
+  if ( stats . m_Processes != 1 || stats . m_Created != 2 || procs[0] . m_ForkBytes != TABLES * CCPU::PAGE_SIZE
+       || stats . m_Total . m_ForkBytes != TABLES * CCPU::PAGE_SIZE
+       || stats . m_Total . m_CowFaults != ( g_Lazy ? WRITTEN : 2 * WRITTEN ) )
+    reportError ( "processes %u, created %u, fork bytes %llu / %llu, total cow faults %llu\n", stats . m_Processes,
+                  stats . m_Created, (unsigned long long) procs[0] . m_ForkBytes,
+                  (unsigned long long) stats . m_Total . m_ForkBytes,
+                  (unsigned long long) stats . m_Total . m_CowFaults );
+
+  if ( ! cpu -> MemUnmap ( 0x10000000, REG_PAGES ) )
+    reportError ( "MemUnmap failed\n" );
+  checkResize ( cpu, 0 );
+  // only the root page table of the init process is left
+  MemMgrStats ( stats, procs, PROCESS_MAX );
+  if ( procs[0] . m_Tables || procs[0] . m_Mapped || procs[0] . m_Resident || procs[0] . m_Reserved
+       || stats . m_FreeFrames != PAGES - 1 )
+    reportError ( "empty process: tables %u, mapped %u, resident %u, reserved %u, free frames %u\n",
+                  procs[0] . m_Tables, procs[0] . m_Mapped, procs[0] . m_Resident, procs[0] . m_Reserved,
+                  stats . m_FreeFrames );
+}
+
+static void        tierProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemStats before, stats;
+  TMemProcStats proc;
+  uint32_t val;
+  MemMgrStats ( before, NULL, 0 );
+  if ( before . m_FreeFrames < SWAP )
+    reportError ( "free frames %u do not include the swap\n", before . m_FreeFrames );
+
+  // even pages compress, odd ones are full of scattered values
+  checkResize ( cpu, 3 * SMALL );
+  for ( uint32_t page = 0; page < 3 * SMALL; page ++ )
+    for ( uint32_t word = 0; word < 1024; word += page % 2 ? 1 : 256 )
+      if ( ! cpu -> WriteInt ( ( page * 1024 + word ) * 4, ( page * 1024 + word ) * 2654435761u ) )
+        reportError ( "WriteInt to page %u failed\n", page );
+  MemMgrStats ( stats, &proc, 1 );
+  if ( proc . m_Swapped == 0 || proc . m_Compressed == 0 || proc . m_Resident >= SMALL )
+    reportError ( "resident %u, swapped %u, compressed %u\n", proc . m_Resident, proc . m_Swapped,
+                  proc . m_Compressed );
+  for ( uint32_t page = 0; page < 3 * SMALL; page ++ )
+    if ( ! cpu -> ReadInt ( page * CCPU::PAGE_SIZE, val ) || val != page * 1024 * 2654435761u )
+      reportError ( "page %u differs\n", page );
+  checkResize ( cpu, 0 );
+  MemMgrStats ( stats, &proc, 1 );
+  if ( proc . m_SwapFaults == 0 || proc . m_ZramFaults == 0 || stats . m_FreeFrames != before . m_FreeFrames )
+    reportError ( "swap faults %llu, zram faults %llu, free frames %u before, %u after\n",
+                  (unsigned long long) proc . m_SwapFaults, (unsigned long long) proc . m_ZramFaults,
+                  before . m_FreeFrames, stats . m_FreeFrames );
+
+  // a sequential read takes far fewer faults than pages
+  if ( ! cpu -> MapFile ( 0x10000000, FILE_PAGES, FILE_NAME, 0, false ) )
+    reportError ( "MapFile failed\n" );
+  for ( uint32_t page = 0; page < FILE_PAGES; page ++ )
+    if ( ! cpu -> ReadInt ( 0x10000000 + page * CCPU::PAGE_SIZE, val ) )
+      reportError ( "ReadInt of the file page %u failed\n", page );
+  MemMgrStats ( stats, &proc, 1 );
+  if ( proc . m_FileFaults == 0 || proc . m_FileFaults > FILE_PAGES / 8 )
+    reportError ( "%llu file faults for %u pages read sequentially\n", (unsigned long long) proc . m_FileFaults,
+                  FILE_PAGES );
+  if ( ! cpu -> MemUnmap ( 0x10000000, FILE_PAGES ) )
+    reportError ( "MemUnmap failed\n" );
+}
+
+// whole regions of the memory limit map large pages without a page table, the split region gets one
+static void        largeProcess                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemStats stats;
+  TMemProcStats proc;
+  checkResize ( cpu, 2500 );
+  MemMgrStats ( stats, &proc, 1 );
+  if ( proc . m_Tables != 1 )
+    reportError ( "%u page tables for 2500 pages\n", proc . m_Tables );
+  checkResize ( cpu, CCPU::PAGE_DIR_ENTRIES + 500 );
+  MemMgrStats ( stats, &proc, 1 );
+  if ( proc . m_Tables != 1 )
+    reportError ( "%u page tables after the split\n", proc . m_Tables );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = g_Lazy = lazy;
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+
+  FILE * f = fopen ( FILE_NAME, "wb" );
+  for ( uint32_t i = 0; f && i < FILE_PAGES * CCPU::PAGE_SIZE; i ++ )
+    fputc ( i % 251, f );
+  if ( ! f || fclose ( f ) )
+    reportError ( "cannot create %s\n", FILE_NAME );
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    config . m_SwapPages = SWAP;
+    config . m_ZramPages = SWAP;
+    config . m_SwapFile = "test15.swap";
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, SMALL, NULL, tierProcess );
+  }
+  unlink ( FILE_NAME );
+
+  TMemMgrConfig config;
+  config . m_LargePages = 3;
+  MemMgrConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, largeProcess );
+  testEnd ( "test #16" );
+  delete [] mem;
+  return 0;
+}
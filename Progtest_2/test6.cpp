@@ -0,0 +1,136 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// swap: the processes together commit three times the memory, the clock replacement moves their pages to the swap
+// file and back. Each process writes its own values so that pages mixed up on the way show, copy-on-write pages of
+// forked processes go out and come back shared
+
+static const uint32_t  PAGES      = 512;
+static const uint32_t  SWAP       = 3000;
+static const uint32_t  PROC_PAGES = 300;
+static const uint32_t  PROCESSES  = 4;
+
+// the filled processes meet here, their pages cannot all be resident then
+static pthread_barrier_t g_Filled;
+static sem_t             g_Done;
+
+static void        fill                                    ( CCPU            * cpu,
+                                                             uint32_t          pages,
+                                                             uint32_t          id )
+{
+  for ( uint32_t addr = 0; addr < pages * CCPU::PAGE_SIZE; addr += 256 )
+    if ( ! cpu -> WriteInt ( addr, addr ^ id ) )
+      reportError ( "process %u: WriteInt ( %x ) failed\n", id, addr );
+}
+
+static void        check                                   ( CCPU            * cpu,
+                                                             uint32_t          pages,
+                                                             uint32_t          id )
+{
+  uint32_t val;
+  for ( uint32_t addr = 0; addr < pages * CCPU::PAGE_SIZE; addr += 256 )
+    if ( ! cpu -> ReadInt ( addr, val ) )
+      reportError ( "process %u: ReadInt ( %x ) failed\n", id, addr );
+    else if ( val != ( addr ^ id ) )
+      reportError ( "process %u: read mismatch at %x: %x, expected %x\n", id, addr, val, addr ^ id );
+}
+
+static void        waitChildren                            ( uint32_t          count )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    sem_wait ( &g_Done );
+}
+
+static void        childProcess                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  if ( ! cpu -> GetMemLimit () )
+  {
+    checkResize ( cpu, PROC_PAGES );
+    fill ( cpu, PROC_PAGES, id );
+    pthread_barrier_wait ( &g_Filled );
+  }
+  for ( int round = 0; round < 3; round ++ )
+  {
+    check ( cpu, PROC_PAGES, id );
+    // rewrite a few pages with the same values, they become dirty again
+    for ( uint32_t page = round; page < PROC_PAGES; page += 7 )
+      if ( ! cpu -> WriteInt ( page * CCPU::PAGE_SIZE, page * CCPU::PAGE_SIZE ^ id ) )
+        reportError ( "process %u: rewrite of page %u failed\n", id, page );
+  }
+  checkResize ( cpu, 0 );
+  sem_post ( &g_Done );
+}
+
+static void        forkProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, PROC_PAGES );
+  fill ( cpu, PROC_PAGES, 7 );
+  pthread_barrier_wait ( &g_Filled );
+  for ( int i = 0; i < 2; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) 7, childProcess, true ) )
+      reportError ( "fork %d failed\n", i );
+  childProcess ( cpu, (void *) 7 );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  // more than the memory and the swap together cannot be committed
+  if ( cpu -> SetMemLimit ( PAGES + SWAP ) )
+    reportError ( "SetMemLimit beyond the swap succeeded\n" );
+
+  pthread_barrier_init ( &g_Filled, NULL, PROCESSES + 1 );
+  sem_init ( &g_Done, 0, 0 );
+  for ( uint32_t i = 1; i <= PROCESSES; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) (uintptr_t) ( i * 1000 ), childProcess, false ) )
+      reportError ( "NewProcess %u failed\n", i );
+  if ( ! cpu -> NewProcess ( NULL, forkProcess, false ) )
+    reportError ( "NewProcess fork failed\n" );
+  // the forking process ends with its two children
+  waitChildren ( PROCESSES + 3 );
+  pthread_barrier_destroy ( &g_Filled );
+  sem_destroy ( &g_Done );
+
+  // the init process alone beyond the memory
+  checkResize ( cpu, 2 * PAGES );
+  rwiTest ( cpu, 0, 2 * PAGES );
+  rTest ( cpu, 0, 2 * PAGES );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    // the zeroing thread runs dry under the overcommit and waits for frames coming back
+    config . m_ZeroHigh = lazy ? 256 : 0;
+    config . m_SwapPages = SWAP;
+    config . m_SwapFile = "test6.swap";
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  testEnd ( "test #7" );
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// zram in front of the swap: sparse pages compress and stay in the memory, pages full of scattered values do not
+// and go to the swap file. The processes share the memory with both kinds at once, copies of forked processes too
+
+static const uint32_t  PAGES      = 512;
+static const uint32_t  SWAP       = 4000;
+static const uint32_t  ZRAM       = 4000;
+static const uint32_t  PROC_PAGES = 400;
+static const uint32_t  PROCESSES  = 4;
+
+static pthread_barrier_t g_Filled;
+static sem_t             g_Done;
+
+// odd processes write every word of a page with values that do not compress, even ones a word in 64
+static uint32_t    step                                    ( uint32_t          id )
+{
+  return id & 1 ? 4 : 256;
+}
+
+static uint32_t    value                                   ( uint32_t          addr,
+                                                             uint32_t          id )
+{
+  return addr * 2654435761u ^ id;
+}
+
+static void        fill                                    ( CCPU            * cpu,
+                                                             uint32_t          id )
+{
+  for ( uint32_t addr = 0; addr < PROC_PAGES * CCPU::PAGE_SIZE; addr += step ( id ) )
+    if ( ! cpu -> WriteInt ( addr, value ( addr, id ) ) )
+      reportError ( "process %u: WriteInt ( %x ) failed\n", id, addr );
+}
+
+static void        check                                   ( CCPU            * cpu,
+                                                             uint32_t          id )
+{
+  uint32_t val;
+  for ( uint32_t addr = 0; addr < PROC_PAGES * CCPU::PAGE_SIZE; addr += step ( id ) )
+    if ( ! cpu -> ReadInt ( addr, val ) )
+      reportError ( "process %u: ReadInt ( %x ) failed\n", id, addr );
+    else if ( val != value ( addr, id ) )
+      reportError ( "process %u: read mismatch at %x: %x, expected %x\n", id, addr, val, value ( addr, id ) );
+}
+
+static void        waitChildren                            ( uint32_t          count )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    sem_wait ( &g_Done );
+}
+
+static void        childProcess                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  if ( ! cpu -> GetMemLimit () )
+  {
+    checkResize ( cpu, PROC_PAGES );
+    fill ( cpu, id );
+    pthread_barrier_wait ( &g_Filled );
+  }
+  for ( int round = 0; round < 3; round ++ )
+  {
+    check ( cpu, id );
+    for ( uint32_t page = round; page < PROC_PAGES; page += 5 )
+      if ( ! cpu -> WriteInt ( page * CCPU::PAGE_SIZE, value ( page * CCPU::PAGE_SIZE, id ) ) )
+        reportError ( "process %u: rewrite of page %u failed\n", id, page );
+  }
+  checkResize ( cpu, 0 );
+  sem_post ( &g_Done );
+}
+
+static void        forkProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, PROC_PAGES );
+  fill ( cpu, 8 );
+  pthread_barrier_wait ( &g_Filled );
+  for ( int i = 0; i < 2; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) 8, childProcess, true ) )
+      reportError ( "fork %d failed\n", i );
+  childProcess ( cpu, (void *) 8 );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  pthread_barrier_init ( &g_Filled, NULL, PROCESSES + 1 );
+  sem_init ( &g_Done, 0, 0 );
+  for ( uint32_t i = 1; i <= PROCESSES; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) (uintptr_t) i, childProcess, false ) )
+      reportError ( "NewProcess %u failed\n", i );
+  if ( ! cpu -> NewProcess ( NULL, forkProcess, false ) )
+    reportError ( "NewProcess fork failed\n" );
+  waitChildren ( PROCESSES + 3 );
+  pthread_barrier_destroy ( &g_Filled );
+  sem_destroy ( &g_Done );
+
+  // the memory of the ended processes is back, zram adds nothing to the memory and the swap
+  checkResize ( cpu, PAGES + SWAP - 20 );
+  if ( cpu -> SetMemLimit ( PAGES + SWAP ) )
+    reportError ( "SetMemLimit beyond the swap succeeded\n" );
+  checkResize ( cpu, 0 );
+}
+
+// zram adds no committed memory, without swap it stays off
+static void        noSwapProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  if ( cpu -> SetMemLimit ( PAGES ) )
+    reportError ( "SetMemLimit beyond the memory succeeded without swap\n" );
+  checkResize ( cpu, PAGES / 2 );
+  rwiTest ( cpu, 0, PAGES / 2 );
+  checkResize ( cpu, 0 );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    config . m_SwapPages = SWAP;
+    config . m_SwapFile = "test7.swap";
+    config . m_ZramPages = ZRAM;
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  TMemMgrConfig config;
+  config . m_ZramPages = ZRAM;
+  MemMgrConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, noSwapProcess );
+  testEnd ( "test #8" );
+  delete [] mem;
+  return 0;
+}
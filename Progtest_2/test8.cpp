@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// large pages: whole 1024 page regions of the memory limit map a 4 MiB run with no page table. Accesses across
+// the region borders, shrinking into a region (splits it), forking (splits the runs for copy-on-write, the parent and
+// both children then write every page, the memory holds three copies) and processes growing and shrinking at once
+
+static const uint32_t  PAGES      = 16 * 1024;
+static const uint32_t  LARGE      = 3;
+static const uint32_t  BASE_SIZE  = 2500;
+static const uint32_t  REGION     = CCPU::PAGE_DIR_ENTRIES;
+
+static sem_t           g_Done;
+
+static void        fill                                    ( CCPU            * cpu,
+                                                             uint32_t          pages,
+                                                             uint32_t          id )
+{
+  for ( uint32_t addr = 0; addr < pages * CCPU::PAGE_SIZE; addr += 128 )
+    if ( ! cpu -> WriteInt ( addr, addr ^ id ) )
+      reportError ( "process %u: WriteInt ( %x ) failed\n", id, addr );
+}
+
+static void        check                                   ( CCPU            * cpu,
+                                                             uint32_t          pages,
+                                                             uint32_t          id )
+{
+  uint32_t val;
+  for ( uint32_t addr = 0; addr < pages * CCPU::PAGE_SIZE; addr += 128 )
+    if ( ! cpu -> ReadInt ( addr, val ) )
+      reportError ( "process %u: ReadInt ( %x ) failed\n", id, addr );
+    else if ( val != ( addr ^ id ) )
+      reportError ( "process %u: read mismatch at %x: %x, expected %x\n", id, addr, val, addr ^ id );
+}
+
+static void        waitChildren                            ( uint32_t          count )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    sem_wait ( &g_Done );
+}
+
+static void        childProcess                            ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  check ( cpu, BASE_SIZE, 1 );
+  fill ( cpu, BASE_SIZE, id );
+  check ( cpu, BASE_SIZE, id );
+  checkResize ( cpu, 0 );
+  sem_post ( &g_Done );
+}
+
+static void        growProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  for ( uint32_t round = 0; round < 5; round ++ )
+  {
+    checkResize ( cpu, 2 * REGION + 50 );
+    fill ( cpu, 2 * REGION + 50, id + round );
+    check ( cpu, 2 * REGION + 50, id + round );
+    checkResize ( cpu, REGION - 24 );
+    check ( cpu, REGION - 24, id + round );
+    checkResize ( cpu, 0 );
+  }
+  sem_post ( &g_Done );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  checkResize ( cpu, BASE_SIZE );
+  fill ( cpu, BASE_SIZE, 1 );
+  check ( cpu, BASE_SIZE, 1 );
+
+  // a block across the border of the first two large pages
+  uint8_t data[10000], back[10000];
+  for ( uint32_t i = 0; i < sizeof ( data ); i ++ )
+    data[i] = i * 7;
+  if ( cpu -> WriteBlock ( ( REGION - 1 ) * CCPU::PAGE_SIZE, data, sizeof ( data ) ) != sizeof ( data )
+       || cpu -> ReadBlock ( ( REGION - 1 ) * CCPU::PAGE_SIZE, back, sizeof ( back ) ) != sizeof ( back )
+       || memcmp ( data, back, sizeof ( data ) ) )
+    reportError ( "block across the large page border differs\n" );
+  fill ( cpu, BASE_SIZE, 1 );
+
+  // shrinking into the second region splits it into a page table, growing back keeps the values
+  checkResize ( cpu, REGION + 500 );
+  check ( cpu, REGION + 500, 1 );
+  checkResize ( cpu, BASE_SIZE );
+  fill ( cpu, BASE_SIZE, 1 );
+
+  sem_init ( &g_Done, 0, 0 );
+  for ( uintptr_t i = 2; i < 4; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) i, childProcess, true ) )
+      reportError ( "fork %u failed\n", (uint32_t) i );
+  fill ( cpu, BASE_SIZE, 9 );
+  check ( cpu, BASE_SIZE, 9 );
+  waitChildren ( 2 );
+  checkResize ( cpu, 0 );
+  iTest ( cpu, 0 );
+
+  for ( uintptr_t i = 1; i <= 3; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) ( i * 100 ), growProcess, false ) )
+      reportError ( "NewProcess %u failed\n", (uint32_t) i );
+  waitChildren ( 3 );
+  sem_destroy ( &g_Done );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    config . m_LargePages = LARGE;
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  testEnd ( "test #9" );
+  delete [] mem;
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdarg>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include "common.h"
+#include "test_op.h"
+using namespace std;
+
+// buddy allocator and compaction: processes growing in small steps at once take interleaved frames, half of them
+// end and leave the free memory in small blocks. Compaction moves the pages of the others until there are free
+// 4 MiB blocks again, the moved pages have to keep their values
+
+static const uint32_t  PAGES      = 8 * 1024;
+static const uint32_t  WORKERS    = 8;
+static const uint32_t  WORK_PAGES = 800;
+static const uint32_t  STEP       = 32;
+
+static pthread_barrier_t g_Grown;
+static pthread_barrier_t g_Compacted;
+static sem_t             g_Done;
+
+static void        fill                                    ( CCPU            * cpu,
+                                                             uint32_t          from,
+                                                             uint32_t          to,
+                                                             uint32_t          id )
+{
+  for ( uint32_t addr = from * CCPU::PAGE_SIZE; addr < to * CCPU::PAGE_SIZE; addr += 256 )
+    if ( ! cpu -> WriteInt ( addr, addr ^ id ) )
+      reportError ( "process %u: WriteInt ( %x ) failed\n", id, addr );
+}
+
+static void        check                                   ( CCPU            * cpu,
+                                                             uint32_t          from,
+                                                             uint32_t          to,
+                                                             uint32_t          id )
+{
+  uint32_t val;
+  for ( uint32_t addr = from * CCPU::PAGE_SIZE; addr < to * CCPU::PAGE_SIZE; addr += 256 )
+    if ( ! cpu -> ReadInt ( addr, val ) )
+      reportError ( "process %u: ReadInt ( %x ) failed\n", id, addr );
+    else if ( val != ( addr ^ id ) )
+      reportError ( "process %u: read mismatch at %x: %x, expected %x\n", id, addr, val, addr ^ id );
+}
+
+static void        waitChildren                            ( uint32_t          count )
+{
+  for ( uint32_t i = 0; i < count; i ++ )
+    sem_wait ( &g_Done );
+}
+
+// the free frames include the pool of zeroed frames besides the blocks, the largest block is the largest order present
+static void        checkFragStats                          ( const TMemFragStats & stats )
+{
+  uint32_t frames = 0, largest = 0;
+  for ( uint32_t order = 0; order < 11; order ++ )
+    if ( stats . m_FreeBlocks[order] )
+    {
+      frames += stats . m_FreeBlocks[order] << order;
+      largest = 1 << order;
+    }
+  if ( frames > stats . m_FreeFrames || largest != stats . m_LargestBlock || stats . m_Unusable > 1000 )
+    reportError ( "frag stats: %u free frames in blocks, %u reported, largest %u / %u, unusable %u\n",
+                  frames, stats . m_FreeFrames, largest, stats . m_LargestBlock, stats . m_Unusable );
+}
+
+static void        workerProcess                           ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  for ( uint32_t pages = STEP; pages <= WORK_PAGES; pages += STEP )
+  {
+    checkResize ( cpu, pages );
+    fill ( cpu, pages - STEP, pages, id );
+  }
+  pthread_barrier_wait ( &g_Grown );
+  if ( id % 2 )
+  {
+    checkResize ( cpu, 0 );
+    sem_post ( &g_Done );
+    return;
+  }
+  pthread_barrier_wait ( &g_Compacted );
+  check ( cpu, 0, WORK_PAGES, id );
+  fill ( cpu, 0, WORK_PAGES, id + 1 );
+  check ( cpu, 0, WORK_PAGES, id + 1 );
+  checkResize ( cpu, 0 );
+  sem_post ( &g_Done );
+}
+
+static void        initProcess                             ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemFragStats before, after;
+  pthread_barrier_init ( &g_Grown, NULL, WORKERS + 1 );
+  pthread_barrier_init ( &g_Compacted, NULL, WORKERS / 2 + 1 );
+  sem_init ( &g_Done, 0, 0 );
+  for ( uintptr_t i = 1; i <= WORKERS; i ++ )
+    if ( ! cpu -> NewProcess ( (void *) i, workerProcess, false ) )
+      reportError ( "NewProcess %u failed\n", (uint32_t) i );
+  pthread_barrier_wait ( &g_Grown );
+  waitChildren ( WORKERS / 2 );
+
+  MemMgrFragStats ( before );
+  checkFragStats ( before );
+  uint32_t blocks = 0;
+  while ( MemMgrCompact () )
+    blocks ++;
+  MemMgrFragStats ( after );
+  checkFragStats ( after );
+  if ( blocks == 0 || after . m_FreeBlocks[10] < before . m_FreeBlocks[10] + blocks
+       || after . m_Unusable > before . m_Unusable )
+    reportError ( "compaction built %u blocks, 4 MiB blocks %u -> %u, unusable %u -> %u\n", blocks,
+                  before . m_FreeBlocks[10], after . m_FreeBlocks[10], before . m_Unusable, after . m_Unusable );
+
+  // the built blocks serve large pages
+  checkResize ( cpu, 2 * CCPU::PAGE_DIR_ENTRIES + 50 );
+  rwiTest ( cpu, 0, 2 * CCPU::PAGE_DIR_ENTRIES + 50 );
+  checkResize ( cpu, 0 );
+  pthread_barrier_wait ( &g_Compacted );
+  waitChildren ( WORKERS / 2 );
+  pthread_barrier_destroy ( &g_Grown );
+  pthread_barrier_destroy ( &g_Compacted );
+  sem_destroy ( &g_Done );
+}
+
+// without m_Compaction no page is moved
+static void        noCompactionProcess                     ( CCPU            * cpu,
+                                                             void            * arg )
+{
+  TMemFragStats stats;
+  MemMgrFragStats ( stats );
+  checkFragStats ( stats );
+  if ( MemMgrCompact () )
+    reportError ( "MemMgrCompact succeeded without m_Compaction\n" );
+}
+
+int                main                                    ( void )
+{
+  // PAGES + extra 4KiB for alignment
+  uint8_t * mem = new uint8_t [ PAGES * CCPU::PAGE_SIZE + CCPU::PAGE_SIZE ];
+
+  // align to a mutiple of 4KiB
+  uint8_t * memAligned = (uint8_t *) (( ((uintptr_t) mem) + CCPU::PAGE_SIZE - 1) & ~(uintptr_t) ~CCPU::ADDR_MASK );
+
+  testStart  ();
+  for ( int lazy = 0; lazy < 2; lazy ++ )
+  {
+    TMemMgrConfig config;
+    config . m_LazyAlloc = lazy;
+    config . m_LargePages = 1;
+    config . m_Compaction = true;
+    MemMgrConfig ( config );
+    MemMgr ( memAligned, PAGES, NULL, initProcess );
+  }
+  TMemMgrConfig config;
+  MemMgrConfig ( config );
+  MemMgr ( memAligned, PAGES, NULL, noCompactionProcess );
+  testEnd ( "test #10" );
+  delete [] mem;
+  return 0;
+}